@@ -16,6 +16,7 @@
 
 // Model
 #import <AltSign/ALTApplication.h>
+#import <AltSign/ALTApplicationCatalog.h>
 #import <AltSign/ALTAccount.h>
 #import <AltSign/ALTAnisetteData.h>
 #import <AltSign/ALTTeam.h>
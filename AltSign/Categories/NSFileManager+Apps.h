@@ -15,6 +15,21 @@ NS_ASSUME_NONNULL_BEGIN
 - (nullable NSURL *)unzipAppBundleAtURL:(NSURL *)ipaURL toDirectory:(NSURL *)directoryURL error:(NSError **)error;
 - (nullable NSURL *)zipAppBundleAtURL:(NSURL *)appBundleURL error:(NSError **)error;
 
+// Files left untouched since being extracted from sourceIPAURL are copied without recompressing them.
+- (nullable NSURL *)zipAppBundleAtURL:(NSURL *)appBundleURL reusingEntriesFromIPAAtURL:(nullable NSURL *)sourceIPAURL error:(NSError **)error;
+
+// Writes a copy of sourceIPAURL to ipaURL with the files at the given archive paths replaced or added. Every other entry is copied without recompressing it.
+- (BOOL)writeIPAAtURL:(NSURL *)ipaURL fromIPAAtURL:(NSURL *)sourceIPAURL replacingItems:(NSDictionary<NSString *, NSData *> *)items error:(NSError **)error;
+
+// Reading from an IPA without extracting it. Paths are relative to the root of the archive, e.g. "Payload/App.app/Info.plist".
+- (nullable NSArray<NSString *> *)pathsOfItemsInIPAAtURL:(NSURL *)ipaURL error:(NSError **)error;
+
+// Paths missing from the IPA are left out of the returned dictionary.
+- (nullable NSDictionary<NSString *, NSData *> *)contentsOfItemsAtPaths:(NSArray<NSString *> *)paths inIPAAtURL:(NSURL *)ipaURL error:(NSError **)error;
+
+// Only the executable's Mach-O headers and code signatures are read; every other byte of the returned data is zero.
+- (nullable NSData *)codeSignatureContentsOfExecutableAtPath:(NSString *)path inIPAAtURL:(NSURL *)ipaURL error:(NSError **)error;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -13,6 +13,14 @@
 #include "zip.h"
 #include "unzip.h"
 
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <mach-o/fat.h>
+#include <mach-o/loader.h>
+
 int ALTReadBufferSize = 8192;
 int ALTMaxFilenameLength = 512;
 char ALTDirectoryDeliminator = '/';
@@ -20,320 +28,1079 @@ char ALTDirectoryDeliminator = '/';
 #define READ_BUFFER_SIZE 8192
 #define MAX_FILENAME 512
 
+// Universal binaries with more architectures than this are treated as corrupt rather than read.
+uint32_t ALTMaximumFatArchitectureCount = 64;
+
+// Archives smaller than this are extracted on the calling thread, since spinning up workers costs more than it saves.
+uLong ALTParallelExtractionThreshold = 4 * 1024 * 1024;
+
+int ALTCompressionLevel = Z_DEFAULT_COMPRESSION;
+
+// Files at least this large are deflated by the writer in parallel blocks rather than held in memory whole.
+uLong ALTBlockDeflateThreshold = 8 * 1024 * 1024;
+uLong ALTBlockDeflateBlockSize = 1024 * 1024;
+
+// Entries this large get Zip64 headers, leaving headroom below 4 GB in case deflating grows incompressible data.
+uLong ALTZip64Threshold = 0xF0000000;
+
+@interface ALTZipEntry : NSObject
+
+@property (nonatomic, copy) NSString *filename;
+@property (nonatomic) NSUInteger index;
+
+@property (nonatomic) unz_file_pos position;
+@property (nonatomic) unz_file_info info;
+
+@property (nonatomic, readonly) BOOL isDirectory;
+@property (nonatomic, readonly) short permissions;
+
+// Extracted files are stamped with this time so unchanged files can be recognized when repacking.
+@property (nonatomic, readonly) time_t modificationTime;
+
+@end
+
+@implementation ALTZipEntry
+
+- (BOOL)isDirectory
+{
+    return [self.filename hasSuffix:@"/"];
+}
+
+- (short)permissions
+{
+    return (self.info.external_fa >> 16) & 0x01FF;
+}
+
+- (time_t)modificationTime
+{
+    struct tm date = {};
+    date.tm_sec = self.info.tmu_date.tm_sec;
+    date.tm_min = self.info.tmu_date.tm_min;
+    date.tm_hour = self.info.tmu_date.tm_hour;
+    date.tm_mday = self.info.tmu_date.tm_mday;
+    date.tm_mon = self.info.tmu_date.tm_mon;
+    date.tm_year = self.info.tmu_date.tm_year - 1900;
+    date.tm_isdst = -1;
+    
+    return mktime(&date);
+}
+
+@end
+
+@interface ALTZipItem : NSObject
+
+@property (nonatomic, copy) NSURL *fileURL;
+@property (nonatomic, copy) NSString *filename;
+@property (nonatomic) BOOL isDirectory;
+
+@property (nonatomic) uLong externalAttributes;
+@property (nonatomic) uLong internalAttributes;
+
+// Set when the file is unchanged and can be copied straight from the source IPA.
+@property (nonatomic, nullable) ALTZipEntry *sourceEntry;
+
+@property (nonatomic, nullable) NSData *compressedData;
+@property (nonatomic) uLong uncompressedSize;
+@property (nonatomic) uLong crc;
+
+@property (nonatomic, nullable) NSError *error;
+
+// Signaled once the item is ready to be written.
+@property (nonatomic, readonly) dispatch_semaphore_t completionSemaphore;
+
+@end
+
+@implementation ALTZipItem
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        _completionSemaphore = dispatch_semaphore_create(0);
+    }
+    
+    return self;
+}
+
+@end
+
 @implementation NSFileManager (Apps)
 
 - (nullable NSURL *)unzipAppBundleAtURL:(NSURL *)ipaURL toDirectory:(NSURL *)directoryURL error:(NSError **)error
 {
-    unzFile zipFile = unzOpen(ipaURL.fileSystemRepresentation);
-    if (zipFile == NULL)
+    NSArray<ALTZipEntry *> *entries = [self zipEntriesInArchiveAtURL:ipaURL error:error];
+    if (entries == nil)
     {
-        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileNoSuchFileError userInfo:@{NSURLErrorKey: ipaURL}];
         return nil;
     }
     
-    FILE *outputFile = nil;
+    NSProgress *progress = [NSProgress progressWithTotalUnitCount:entries.count];
+    
+    // Create all directories up front so workers never race to create the same parent directory.
+    NSMutableOrderedSet<NSURL *> *directoryURLs = [NSMutableOrderedSet orderedSet];
+    NSMutableArray<ALTZipEntry *> *fileEntries = [NSMutableArray array];
     
-    void (^finish)(void) = ^{
-        if (outputFile != nil)
+    for (ALTZipEntry *entry in entries)
+    {
+        NSURL *fileURL = [directoryURL URLByAppendingPathComponent:entry.filename];
+        
+        if (entry.isDirectory)
         {
-            fclose(outputFile);
+            [directoryURLs addObject:fileURL];
+        }
+        else
+        {
+            [directoryURLs addObject:[fileURL URLByDeletingLastPathComponent]];
+            [fileEntries addObject:entry];
         }
+    }
+    
+    for (NSURL *url in directoryURLs)
+    {
+        if (![self createDirectoryAtURL:url withIntermediateDirectories:YES attributes:nil error:error])
+        {
+            return nil;
+        }
+    }
+    
+    progress.completedUnitCount = entries.count - fileEntries.count;
+    
+    uLong totalCompressedSize = 0;
+    for (ALTZipEntry *entry in fileEntries)
+    {
+        totalCompressedSize += entry.info.compressed_size;
+    }
+    
+    NSUInteger workerCount = MIN(NSProcessInfo.processInfo.activeProcessorCount, fileEntries.count);
+    if (totalCompressedSize < ALTParallelExtractionThreshold)
+    {
+        workerCount = 1;
+    }
+    
+    NSArray<NSArray<ALTZipEntry *> *> *partitions = [self partitionZipEntries:fileEntries count:MAX(workerCount, 1)];
+    
+    NSObject *lock = [[NSObject alloc] init];
+    
+    __block NSUInteger failedIndex = NSNotFound;
+    __block NSError *extractionError = nil;
+    
+    dispatch_apply(partitions.count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+        NSArray<ALTZipEntry *> *partition = partitions[i];
         
-        unzCloseCurrentFile(zipFile);
-        unzClose(zipFile);
-    };
+        [self extractZipEntries:partition fromArchiveAtURL:ipaURL toDirectory:directoryURL shouldContinue:^BOOL(ALTZipEntry *entry) {
+            @synchronized(lock)
+            {
+                // Keep extracting entries that precede the earliest failure so the reported error doesn't depend on scheduling.
+                return failedIndex == NSNotFound || entry.index < failedIndex;
+            }
+        } completionHandler:^(ALTZipEntry *entry, NSError *error) {
+            @synchronized(lock)
+            {
+                if (error == nil)
+                {
+                    progress.completedUnitCount += 1;
+                }
+                else if (entry.index < failedIndex)
+                {
+                    failedIndex = entry.index;
+                    extractionError = error;
+                }
+            }
+        }];
+    });
+    
+    if (extractionError != nil)
+    {
+        *error = extractionError;
+        return nil;
+    }
+    
+    NSURL *payloadDirectory = [directoryURL URLByAppendingPathComponent:@"Payload"];
+    NSArray *contents = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:payloadDirectory.path error:error];
+    if (contents == nil)
+    {
+        return nil;
+    }
+    
+    for (NSString *filename in contents)
+    {
+        if ([filename.pathExtension.lowercaseString isEqualToString:@"app"])
+        {
+            NSURL *appBundleURL = [payloadDirectory URLByAppendingPathComponent:filename];
+            NSURL *outputURL = [directoryURL URLByAppendingPathComponent:filename];
+            
+            if (![[NSFileManager defaultManager] moveItemAtURL:appBundleURL toURL:outputURL error:error])
+            {
+                return nil;
+            }
+            
+            NSError *deleteError = nil;
+            if (![[NSFileManager defaultManager] removeItemAtURL:payloadDirectory error:&deleteError])
+            {
+                *error = deleteError;
+                return nil;
+            }
+            
+            return outputURL;
+        }
+    }
+    
+    *error = [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorMissingAppBundle userInfo:@{NSURLErrorKey: ipaURL}];
+    return nil;
+}
+
+- (nullable NSArray<ALTZipEntry *> *)zipEntriesInArchiveAtURL:(NSURL *)ipaURL error:(NSError **)error
+{
+    zlib_filefunc_def filefunc;
+    fill_pread_filefunc(&filefunc);
+    
+    unzFile zipFile = unzOpen2(ipaURL.fileSystemRepresentation, &filefunc);
+    if (zipFile == NULL)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileNoSuchFileError userInfo:@{NSURLErrorKey: ipaURL}];
+        return nil;
+    }
     
     unz_global_info zipInfo;
     if (unzGetGlobalInfo(zipFile, &zipInfo) != UNZ_OK)
     {
         *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:@{NSURLErrorKey: ipaURL}];
         
-        finish();
+        unzClose(zipFile);
         return nil;
     }
     
-    NSProgress *progress = [NSProgress progressWithTotalUnitCount:zipInfo.number_entry];
+    NSMutableArray<ALTZipEntry *> *entries = [NSMutableArray arrayWithCapacity:zipInfo.number_entry];
     
-    char buffer[ALTReadBufferSize];
-    
-    for (int i = 0; i < zipInfo.number_entry; i++)
+    for (uLong i = 0; i < zipInfo.number_entry; i++)
     {
         unz_file_info info;
+        unz_file_pos position;
         char cFilename[ALTMaxFilenameLength];
         
-        if (unzGetCurrentFileInfo(zipFile, &info, cFilename, ALTMaxFilenameLength, NULL, 0, NULL, 0) != UNZ_OK)
+        if (unzGetCurrentFileInfo(zipFile, &info, cFilename, ALTMaxFilenameLength, NULL, 0, NULL, 0) != UNZ_OK || unzGetFilePos(zipFile, &position) != UNZ_OK)
         {
             *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSURLErrorKey: ipaURL}];
             
-            finish();
+            unzClose(zipFile);
             return nil;
         }
         
         NSString *filename = [[NSString alloc] initWithCString:cFilename encoding:NSUTF8StringEncoding];
-        if ([filename hasPrefix:@"__MACOSX"])
+        if (filename.length > 0 && ![filename hasPrefix:@"__MACOSX"])
+        {
+            ALTZipEntry *entry = [[ALTZipEntry alloc] init];
+            entry.filename = filename;
+            entry.index = entries.count;
+            entry.position = position;
+            entry.info = info;
+            [entries addObject:entry];
+        }
+        
+        if (i + 1 < zipInfo.number_entry)
         {
-            if (i + 1 < zipInfo.number_entry)
+            if (unzGoToNextFile(zipFile) != UNZ_OK)
             {
-                if (unzGoToNextFile(zipFile) != UNZ_OK)
-                {
-                    *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSFilePathErrorKey: filename}];
-                    
-                    finish();
-                    return nil;
-                }
+                *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSFilePathErrorKey: filename ?: @""}];
+                
+                unzClose(zipFile);
+                return nil;
             }
+        }
+    }
+    
+    unzClose(zipFile);
+    
+    return entries;
+}
+
+- (NSArray<NSArray<ALTZipEntry *> *> *)partitionZipEntries:(NSArray<ALTZipEntry *> *)entries count:(NSUInteger)count
+{
+    // Longest-processing-time-first: hand the largest remaining entry to the least loaded partition.
+    NSArray<ALTZipEntry *> *sortedEntries = [entries sortedArrayUsingComparator:^NSComparisonResult(ALTZipEntry *entryA, ALTZipEntry *entryB) {
+        if (entryA.info.compressed_size != entryB.info.compressed_size)
+        {
+            return (entryA.info.compressed_size > entryB.info.compressed_size) ? NSOrderedAscending : NSOrderedDescending;
+        }
+        
+        return (entryA.index < entryB.index) ? NSOrderedAscending : NSOrderedDescending;
+    }];
+    
+    NSMutableArray<NSMutableArray<ALTZipEntry *> *> *partitions = [NSMutableArray arrayWithCapacity:count];
+    uint64_t *loads = (uint64_t *)calloc(count, sizeof(uint64_t));
+    
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        [partitions addObject:[NSMutableArray array]];
+    }
+    
+    for (ALTZipEntry *entry in sortedEntries)
+    {
+        NSUInteger lightestPartition = 0;
+        for (NSUInteger i = 1; i < count; i++)
+        {
+            if (loads[i] < loads[lightestPartition])
+            {
+                lightestPartition = i;
+            }
+        }
+        
+        // Weight each entry by a nominal page so thousands of tiny files still spread across workers.
+        loads[lightestPartition] += entry.info.compressed_size + 4096;
+        [partitions[lightestPartition] addObject:entry];
+    }
+    
+    free(loads);
+    
+    // Within a partition, read entries in archive order to keep I/O sequential.
+    for (NSMutableArray<ALTZipEntry *> *partition in partitions)
+    {
+        [partition sortUsingComparator:^NSComparisonResult(ALTZipEntry *entryA, ALTZipEntry *entryB) {
+            return (entryA.index < entryB.index) ? NSOrderedAscending : NSOrderedDescending;
+        }];
+    }
+    
+    return partitions;
+}
+
+- (void)extractZipEntries:(NSArray<ALTZipEntry *> *)entries fromArchiveAtURL:(NSURL *)ipaURL toDirectory:(NSURL *)directoryURL
+           shouldContinue:(BOOL (^)(ALTZipEntry *entry))shouldContinue completionHandler:(void (^)(ALTZipEntry *entry, NSError *_Nullable error))completionHandler
+{
+    if (entries.count == 0)
+    {
+        return;
+    }
+    
+    // Each worker reads through its own unzFile, since minizip handles keep a file position and can't be shared.
+    // Mapping the archive lets every worker read it without seeking or contending on a stdio lock.
+    zlib_filefunc_def filefunc;
+    fill_mmap_filefunc(&filefunc);
+    
+    unzFile zipFile = unzOpen2(ipaURL.fileSystemRepresentation, &filefunc);
+    if (zipFile == NULL)
+    {
+        completionHandler(entries.firstObject, [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileNoSuchFileError userInfo:@{NSURLErrorKey: ipaURL}]);
+        return;
+    }
+    
+    char *buffer = (char *)malloc(ALTReadBufferSize);
+    
+    for (ALTZipEntry *entry in entries)
+    {
+        if (!shouldContinue(entry))
+        {
+            break;
+        }
+        
+        NSURL *fileURL = [directoryURL URLByAppendingPathComponent:entry.filename];
+        
+        NSError *error = nil;
+        [self extractCurrentFileFromZipFile:zipFile entry:entry toURL:fileURL buffer:buffer error:&error];
+        
+        completionHandler(entry, error);
+    }
+    
+    free(buffer);
+    unzClose(zipFile);
+}
+
+- (BOOL)extractCurrentFileFromZipFile:(unzFile)zipFile entry:(ALTZipEntry *)entry toURL:(NSURL *)fileURL buffer:(char *)buffer error:(NSError **)error
+{
+    unz_file_pos position = entry.position;
+    if (unzGoToFilePos(zipFile, &position) != UNZ_OK || unzOpenCurrentFile(zipFile) != UNZ_OK)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSURLErrorKey: fileURL}];
+        return NO;
+    }
+    
+    FILE *outputFile = fopen(fileURL.fileSystemRepresentation, "wb");
+    if (outputFile == NULL)
+    {
+        NSError *underlyingError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSURLErrorKey: fileURL}];
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: fileURL, NSUnderlyingErrorKey: underlyingError}];
+        
+        unzCloseCurrentFile(zipFile);
+        return NO;
+    }
+    
+    int result = UNZ_OK;
+    
+    do
+    {
+        result = unzReadCurrentFile(zipFile, buffer, ALTReadBufferSize);
+        
+        if (result < 0)
+        {
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSURLErrorKey: fileURL}];
+            
+            fclose(outputFile);
+            unzCloseCurrentFile(zipFile);
+            return NO;
+        }
+        
+        size_t count = fwrite(buffer, result, 1, outputFile);
+        if (result > 0 && count != 1)
+        {
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: fileURL}];
             
+            fclose(outputFile);
+            unzCloseCurrentFile(zipFile);
+            return NO;
+        }
+        
+    } while (result > 0);
+    
+    if (fchmod(fileno(outputFile), entry.permissions) != 0)
+    {
+        NSError *underlyingError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSURLErrorKey: fileURL}];
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: fileURL, NSUnderlyingErrorKey: underlyingError}];
+        
+        fclose(outputFile);
+        unzCloseCurrentFile(zipFile);
+        return NO;
+    }
+    
+    // Flush first so buffered writes don't bump the modification time afterwards.
+    // Failing to stamp the file only means it's recompressed when repacking, so errors are ignored.
+    fflush(outputFile);
+    
+    struct timeval times[2] = {{entry.modificationTime, 0}, {entry.modificationTime, 0}};
+    futimes(fileno(outputFile), times);
+    
+    fclose(outputFile);
+    
+    if (unzCloseCurrentFile(zipFile) != UNZ_OK)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:@{NSURLErrorKey: fileURL}];
+        return NO;
+    }
+    
+    return YES;
+}
+
+- (nullable NSArray<NSString *> *)pathsOfItemsInIPAAtURL:(NSURL *)ipaURL error:(NSError **)error
+{
+    NSArray<ALTZipEntry *> *entries = [self zipEntriesInArchiveAtURL:ipaURL error:error];
+    if (entries == nil)
+    {
+        return nil;
+    }
+    
+    NSMutableArray<NSString *> *paths = [NSMutableArray arrayWithCapacity:entries.count];
+    for (ALTZipEntry *entry in entries)
+    {
+        [paths addObject:entry.filename];
+    }
+    
+    return paths;
+}
+
+- (nullable NSDictionary<NSString *, NSData *> *)contentsOfItemsAtPaths:(NSArray<NSString *> *)paths inIPAAtURL:(NSURL *)ipaURL error:(NSError **)error
+{
+    unzFile zipFile = [self openIndexedZipFileAtURL:ipaURL error:error];
+    if (zipFile == NULL)
+    {
+        return nil;
+    }
+    
+    NSMutableDictionary<NSString *, NSData *> *contents = [NSMutableDictionary dictionaryWithCapacity:paths.count];
+    
+    for (NSString *path in paths)
+    {
+        if (unzLocateFile(zipFile, path.fileSystemRepresentation, 1) != UNZ_OK)
+        {
             continue;
         }
         
-        NSError *(^createDirectory)(NSURL *) = ^NSError *(NSURL *directoryURL) {
-            NSError *error = nil;
-            if (![self createDirectoryAtURL:directoryURL withIntermediateDirectories:YES attributes:nil error:&error])
+        unz_file_info info;
+        if (unzGetCurrentFileInfo(zipFile, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK || unzOpenCurrentFile(zipFile) != UNZ_OK)
+        {
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSFilePathErrorKey: path}];
+            
+            unzClose(zipFile);
+            return nil;
+        }
+        
+        NSMutableData *data = [NSMutableData dataWithLength:info.uncompressed_size];
+        
+        // Closing checks the CRC, but only once the whole file has been read.
+        if (![self readBytes:(char *)data.mutableBytes length:data.length fromCurrentFileInZipFile:zipFile] || unzCloseCurrentFile(zipFile) != UNZ_OK)
+        {
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:@{NSFilePathErrorKey: path}];
+            
+            unzCloseCurrentFile(zipFile);
+            unzClose(zipFile);
+            return nil;
+        }
+        
+        contents[path] = data;
+    }
+    
+    unzClose(zipFile);
+    
+    return contents;
+}
+
+- (nullable NSData *)codeSignatureContentsOfExecutableAtPath:(NSString *)path inIPAAtURL:(NSURL *)ipaURL error:(NSError **)error
+{
+    unzFile zipFile = [self openIndexedZipFileAtURL:ipaURL error:error];
+    if (zipFile == NULL)
+    {
+        return nil;
+    }
+    
+    unz_file_info info;
+    if (unzLocateFile(zipFile, path.fileSystemRepresentation, 1) != UNZ_OK)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadNoSuchFileError userInfo:@{NSFilePathErrorKey: path}];
+        
+        unzClose(zipFile);
+        return nil;
+    }
+    
+    if (unzGetCurrentFileInfo(zipFile, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK || info.uncompressed_size < sizeof(struct mach_header) || unzOpenCurrentFile(zipFile) != UNZ_OK)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:@{NSFilePathErrorKey: path}];
+        
+        unzClose(zipFile);
+        return nil;
+    }
+    
+    // Anonymous pages are only backed by memory once written to, so the bytes we skip cost nothing.
+    uLong size = info.uncompressed_size;
+    uint8_t *bytes = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (bytes == MAP_FAILED)
+    {
+        NSError *underlyingError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSFilePathErrorKey: path, NSUnderlyingErrorKey: underlyingError}];
+        
+        unzCloseCurrentFile(zipFile);
+        unzClose(zipFile);
+        return nil;
+    }
+    
+    char *buffer = (char *)malloc(ALTReadBufferSize);
+    __block uLong position = 0;
+    
+    // Deflated data can only be read front to back, so ranges must be requested in increasing order.
+    // Whatever part of a range was already read is skipped.
+    BOOL (^readRange)(uLong, uLong) = ^BOOL(uLong offset, uLong length) {
+        if (offset > size || length > size - offset)
+        {
+            return NO;
+        }
+        
+        if (offset < position)
+        {
+            uLong overlap = MIN(position - offset, length);
+            offset += overlap;
+            length -= overlap;
+        }
+        
+        while (position < offset)
+        {
+            int result = unzReadCurrentFile(zipFile, buffer, (unsigned int)MIN((uLong)ALTReadBufferSize, offset - position));
+            if (result <= 0)
             {
-                return error;
+                return NO;
             }
             
-            return nil;
-        };
+            position += result;
+        }
         
-        NSURL *fileURL = [directoryURL URLByAppendingPathComponent:filename];
+        if (![self readBytes:(char *)bytes + offset length:length fromCurrentFileInZipFile:zipFile])
+        {
+            return NO;
+        }
         
-        if ([filename characterAtIndex:filename.length - 1] == ALTDirectoryDeliminator)
+        position += length;
+        return YES;
+    };
+    
+    BOOL success = readRange(0, sizeof(uint32_t));
+    
+    // Universal binary headers are big-endian.
+    uint32_t magic = success ? OSSwapBigToHostInt32(*(uint32_t *)bytes) : 0;
+    BOOL isUniversal = (magic == FAT_MAGIC || magic == FAT_MAGIC_64);
+    uLong archSize = (magic == FAT_MAGIC_64) ? sizeof(struct fat_arch_64) : sizeof(struct fat_arch);
+    
+    uint32_t sliceCount = 1;
+    
+    if (success && isUniversal)
+    {
+        success = readRange(0, sizeof(struct fat_header));
+        if (success)
         {
-            // Directory
+            uint32_t archCount = OSSwapBigToHostInt32(((struct fat_header *)bytes)->nfat_arch);
+            success = (archCount <= ALTMaximumFatArchitectureCount) && readRange(sizeof(struct fat_header), archCount * archSize);
             
-            NSError *directoryError = createDirectory(fileURL);
-            if (directoryError != nil)
+            if (success)
             {
-                *error = directoryError;
-                return nil;
+                sliceCount = archCount;
             }
         }
-        else
+    }
+    
+    uLong *sliceOffsets = (uLong *)calloc(MAX(sliceCount, 1), sizeof(uLong));
+    
+    if (success && isUniversal)
+    {
+        for (uint32_t i = 0; i < sliceCount; i++)
         {
-            // File            
-            if (unzOpenCurrentFile(zipFile) != UNZ_OK)
+            uint8_t *arch = bytes + sizeof(struct fat_header) + i * archSize;
+            
+            if (magic == FAT_MAGIC_64)
             {
-                *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSURLErrorKey: fileURL}];
-                
-                finish();
-                return nil;
+                sliceOffsets[i] = OSSwapBigToHostInt64(((struct fat_arch_64 *)arch)->offset);
+            }
+            else
+            {
+                sliceOffsets[i] = OSSwapBigToHostInt32(((struct fat_arch *)arch)->offset);
+            }
+        }
+        
+        // Every architecture is read now, so the slices can be visited in file order.
+        qsort_b(sliceOffsets, sliceCount, sizeof(uLong), ^int(const void *a, const void *b) {
+            uLong offsetA = *(const uLong *)a;
+            uLong offsetB = *(const uLong *)b;
+            return (offsetA < offsetB) ? -1 : (offsetA > offsetB);
+        });
+    }
+    
+    for (uint32_t i = 0; success && i < sliceCount; i++)
+    {
+        uLong offset = sliceOffsets[i];
+        
+        success = readRange(offset, sizeof(struct mach_header));
+        if (!success)
+        {
+            break;
+        }
+        
+        struct mach_header *header = (struct mach_header *)(bytes + offset);
+        uLong headerSize = (header->magic == MH_MAGIC_64) ? sizeof(struct mach_header_64) : sizeof(struct mach_header);
+        
+        success = (header->magic == MH_MAGIC || header->magic == MH_MAGIC_64) && readRange(offset, headerSize + header->sizeofcmds);
+        
+        uLong commandOffset = offset + headerSize;
+        uLong commandsEnd = commandOffset + header->sizeofcmds;
+        
+        uLong signatureOffset = 0;
+        uLong signatureSize = 0;
+        
+        for (uint32_t j = 0; success && j < header->ncmds; j++)
+        {
+            struct load_command *command = (struct load_command *)(bytes + commandOffset);
+            if (commandsEnd - commandOffset < sizeof(struct load_command) || command->cmdsize < sizeof(struct load_command) || command->cmdsize > commandsEnd - commandOffset)
+            {
+                success = NO;
+                break;
+            }
+            
+            if (command->cmd == LC_CODE_SIGNATURE && command->cmdsize >= sizeof(struct linkedit_data_command))
+            {
+                struct linkedit_data_command *signatureCommand = (struct linkedit_data_command *)command;
+                signatureOffset = offset + signatureCommand->dataoff;
+                signatureSize = signatureCommand->datasize;
+            }
+            
+            commandOffset += command->cmdsize;
+        }
+        
+        if (success && signatureSize > 0)
+        {
+            success = readRange(signatureOffset, signatureSize);
+        }
+    }
+    
+    free(sliceOffsets);
+    free(buffer);
+    
+    unzCloseCurrentFile(zipFile);
+    unzClose(zipFile);
+    
+    if (!success)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:@{NSFilePathErrorKey: path}];
+        
+        munmap(bytes, size);
+        return nil;
+    }
+    
+    NSData *data = [[NSData alloc] initWithBytesNoCopy:bytes length:size deallocator:^(void *bytes, NSUInteger length) {
+        munmap(bytes, length);
+    }];
+    return data;
+}
+
+- (nullable unzFile)openIndexedZipFileAtURL:(NSURL *)ipaURL error:(NSError **)error
+{
+    zlib_filefunc_def filefunc;
+    fill_pread_filefunc(&filefunc);
+    
+    unzFile zipFile = unzOpen2(ipaURL.fileSystemRepresentation, &filefunc);
+    if (zipFile == NULL)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileNoSuchFileError userInfo:@{NSURLErrorKey: ipaURL}];
+        return NULL;
+    }
+    
+    // One pass over the central directory, then each lookup is a hash probe.
+    if (unzBuildIndex(zipFile) != UNZ_OK)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:@{NSURLErrorKey: ipaURL}];
+        
+        unzClose(zipFile);
+        return NULL;
+    }
+    
+    return zipFile;
+}
+
+- (BOOL)readBytes:(char *)bytes length:(uLong)length fromCurrentFileInZipFile:(unzFile)zipFile
+{
+    uLong offset = 0;
+    
+    while (offset < length)
+    {
+        // unzReadCurrentFile takes an unsigned length, so read files larger than 4 GB in pieces.
+        int result = unzReadCurrentFile(zipFile, bytes + offset, (unsigned int)MIN(length - offset, (uLong)INT_MAX));
+        if (result <= 0)
+        {
+            return NO;
+        }
+        
+        offset += result;
+    }
+    
+    return YES;
+}
+
+- (NSURL *)zipAppBundleAtURL:(NSURL *)appBundleURL error:(NSError **)error
+{
+    return [self zipAppBundleAtURL:appBundleURL reusingEntriesFromIPAAtURL:nil error:error];
+}
+
+- (nullable NSURL *)zipAppBundleAtURL:(NSURL *)appBundleURL reusingEntriesFromIPAAtURL:(nullable NSURL *)sourceIPAURL error:(NSError **)error
+{
+    NSString *appBundleFilename = [appBundleURL lastPathComponent];
+    NSString *appName = [appBundleFilename stringByDeletingPathExtension];
+    
+    NSString *ipaName = [NSString stringWithFormat:@"%@.ipa", appName];
+    NSURL *ipaURL = [[appBundleURL URLByDeletingLastPathComponent] URLByAppendingPathComponent:ipaName];
+    
+    if ([self fileExistsAtPath:ipaURL.path])
+    {
+        if (![self removeItemAtURL:ipaURL error:error])
+        {
+            return nil;
+        }
+    }
+    
+    NSMutableDictionary<NSString *, ALTZipEntry *> *sourceEntries = nil;
+    
+    if (sourceIPAURL != nil)
+    {
+        NSArray<ALTZipEntry *> *entries = [self zipEntriesInArchiveAtURL:sourceIPAURL error:error];
+        if (entries == nil)
+        {
+            return nil;
+        }
+        
+        sourceEntries = [NSMutableDictionary dictionaryWithCapacity:entries.count];
+        for (ALTZipEntry *entry in entries)
+        {
+            if (!entry.isDirectory)
+            {
+                sourceEntries[entry.filename] = entry;
             }
+        }
+    }
+    
+    NSURL *payloadDirectory = [NSURL fileURLWithPath:@"Payload" isDirectory:YES];
+    NSURL *appBundleDirectory = [payloadDirectory URLByAppendingPathComponent:appBundleFilename isDirectory:YES];
+    
+    NSDirectoryEnumerator *enumerator = [self enumeratorAtURL:appBundleURL
+                                   includingPropertiesForKeys:@[NSURLIsDirectoryKey]
+                                                      options:0
+                                                 errorHandler:^BOOL(NSURL * _Nonnull url, NSError * _Nonnull error) {
+        if (error) {
+            NSLog(@"[Error] %@ (%@)", error, url);
+            return NO;
+        }
+        
+        return YES;
+    }];
+    
+    NSMutableArray<ALTZipItem *> *items = [NSMutableArray array];
+    
+    for (NSURL *fileURL in enumerator)
+    {
+        NSNumber *isDirectory = nil;
+        if (![fileURL getResourceValue:&isDirectory forKey:NSURLIsDirectoryKey error:error])
+        {
+            return nil;
+        }
+        
+        ALTZipItem *item = [self zipItemForItemAtURL:fileURL depth:enumerator.level relativeURL:appBundleDirectory isDirectory:[isDirectory boolValue] sourceEntries:sourceEntries error:error];
+        if (item == nil)
+        {
+            return nil;
+        }
+        
+        [items addObject:item];
+    }
+    
+    // We add two extra entries at the end.
+    [items addObject:[self zipItemForItemAtURL:payloadDirectory depth:1 relativeURL:nil isDirectory:YES sourceEntries:nil error:error]];
+    [items addObject:[self zipItemForItemAtURL:appBundleDirectory depth:2 relativeURL:nil isDirectory:YES sourceEntries:nil error:error]];
+    
+    NSProgress *progress = [NSProgress progressWithTotalUnitCount:items.count];
+    
+    zipFile zipFile = zipOpen(ipaURL.fileSystemRepresentation, APPEND_STATUS_CREATE);
+    if (zipFile == nil)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: ipaURL}];
+        return nil;
+    }
+    
+    zipSetParallelDeflate(zipFile, (int)NSProcessInfo.processInfo.activeProcessorCount, ALTBlockDeflateBlockSize);
+    
+    unzFile sourceZipFile = NULL;
+    
+    if (sourceIPAURL != nil)
+    {
+        zlib_filefunc_def filefunc;
+        fill_mmap_filefunc(&filefunc);
+        
+        sourceZipFile = unzOpen2(sourceIPAURL.fileSystemRepresentation, &filefunc);
+        if (sourceZipFile == NULL)
+        {
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileNoSuchFileError userInfo:@{NSURLErrorKey: sourceIPAURL}];
+            
+            zipClose(zipFile, NULL);
+            return nil;
+        }
+    }
+    
+    // Files are deflated concurrently into memory, then appended to the archive in enumeration order
+    // through minizip's raw mode, so the resulting IPA is identical to one compressed serially.
+    // The semaphore caps how many compressed files can be waiting on the writer at once.
+    dispatch_queue_t compressionQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    dispatch_queue_t schedulingQueue = dispatch_queue_create("com.rileytestut.AltSign.ZipScheduling", DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t pendingSemaphore = dispatch_semaphore_create(NSProcessInfo.processInfo.activeProcessorCount * 2);
+    
+    // Set by the writer below and read by every compression block, so it has to be atomic.
+    __block atomic_bool isCancelled = false;
+    
+    dispatch_async(schedulingQueue, ^{
+        for (ALTZipItem *item in items)
+        {
+            dispatch_semaphore_wait(pendingSemaphore, DISPATCH_TIME_FOREVER);
             
-            NSURL *parentDirectory = [fileURL URLByDeletingLastPathComponent];
-            if (![[NSFileManager defaultManager] fileExistsAtPath:parentDirectory.path])
+            dispatch_async(compressionQueue, ^{
+                if (!atomic_load(&isCancelled))
+                {
+                    [self compressZipItem:item];
+                }
+                
+                dispatch_semaphore_signal(item.completionSemaphore);
+            });
+        }
+    });
+    
+    BOOL success = YES;
+    
+    // Large files are streamed through this one buffer, so the writer's memory use doesn't depend on file size.
+    char *buffer = (char *)malloc(ALTBlockDeflateBlockSize);
+    
+    for (ALTZipItem *item in items)
+    {
+        dispatch_semaphore_wait(item.completionSemaphore, DISPATCH_TIME_FOREVER);
+        
+        if (success)
+        {
+            if (item.error != nil)
             {
-                NSError *directoryError = createDirectory(parentDirectory);
-                if (directoryError != nil)
+                if (error)
                 {
-                    *error = directoryError;
-                    return nil;
+                    *error = item.error;
                 }
+                
+                success = NO;
             }
-            
-            outputFile = fopen(fileURL.fileSystemRepresentation, "wb");
-            if (outputFile == NULL)
+            else if (![self writeZipItem:item toZipFile:zipFile sourceZipFile:sourceZipFile buffer:buffer error:error])
             {
-                NSError *underlyingError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSURLErrorKey: fileURL}];
-                *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: fileURL, NSUnderlyingErrorKey: underlyingError}];
-                
-                finish();
-                return nil;
+                success = NO;
             }
             
-            int result = UNZ_OK;
-            
-            do
+            if (!success)
             {
-                result = unzReadCurrentFile(zipFile, buffer, ALTReadBufferSize);
-                
-                if (result < 0)
-                {
-                    *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSURLErrorKey: fileURL}];
-                    
-                    finish();
-                    return nil;
-                }
-                
-                size_t count = fwrite(buffer, result, 1, outputFile);
-                if (result > 0 && count != 1)
-                {
-                    *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: fileURL}];
-                    
-                    finish();
-                    return nil;
-                }
-                
-            } while (result > 0);
-            
-            short permissions = (info.external_fa >> 16) & 0x01FF;
-            if (![self setAttributes:@{NSFilePosixPermissions: @(permissions)} ofItemAtPath:fileURL.path error:error])
+                // Keep draining remaining items so the scheduler can finish, but skip compressing them.
+                atomic_store(&isCancelled, true);
+            }
+            else
             {
-                finish();
-                return nil;
+                progress.completedUnitCount += 1;
             }
-            
-            fclose(outputFile);
-            outputFile = NULL;
         }
         
-        unzCloseCurrentFile(zipFile);
-        
-        progress.completedUnitCount += 1;
-        
-        if (i + 1 < zipInfo.number_entry)
+        item.compressedData = nil;
+        dispatch_semaphore_signal(pendingSemaphore);
+    }
+    
+    free(buffer);
+    
+    // The whole central directory is written when the archive is closed, so if that fails the IPA is unreadable.
+    if (zipClose(zipFile, NULL) != ZIP_OK && success)
+    {
+        if (error)
         {
-            if (unzGoToNextFile(zipFile) != UNZ_OK)
-            {
-                *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSURLErrorKey: fileURL}];
-                
-                finish();
-                return nil;
-            }
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: ipaURL}];
         }
+        
+        success = NO;
     }
     
-    finish();
-    
-    NSURL *payloadDirectory = [directoryURL URLByAppendingPathComponent:@"Payload"];
-    NSArray *contents = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:payloadDirectory.path error:error];
-    if (contents == nil)
+    if (sourceZipFile != NULL)
     {
-        finish();
-        return nil;
+        unzClose(sourceZipFile);
     }
     
-    for (NSString *filename in contents)
+    if (!success)
     {
-        if ([filename.pathExtension.lowercaseString isEqualToString:@"app"])
-        {
-            NSURL *appBundleURL = [payloadDirectory URLByAppendingPathComponent:filename];
-            NSURL *outputURL = [directoryURL URLByAppendingPathComponent:filename];
-            
-            if (![[NSFileManager defaultManager] moveItemAtURL:appBundleURL toURL:outputURL error:error])
-            {
-                finish();
-                return nil;
-            }
-            
-            NSError *deleteError = nil;
-            if (![[NSFileManager defaultManager] removeItemAtURL:payloadDirectory error:&deleteError])
-            {
-                *error = deleteError;
-                
-                finish();
-                return nil;
-            }
-            
-            return outputURL;
-        }
+        [self removeItemAtURL:ipaURL error:nil];
+        return nil;
     }
     
-    *error = [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorMissingAppBundle userInfo:@{NSURLErrorKey: ipaURL}];
-    return nil;
+    return ipaURL;
 }
 
-- (NSURL *)zipAppBundleAtURL:(NSURL *)appBundleURL error:(NSError **)error
+- (BOOL)writeIPAAtURL:(NSURL *)ipaURL fromIPAAtURL:(NSURL *)sourceIPAURL replacingItems:(NSDictionary<NSString *, NSData *> *)replacementItems error:(NSError **)error
 {
-    NSString *appBundleFilename = [appBundleURL lastPathComponent];
-    NSString *appName = [appBundleFilename stringByDeletingPathExtension];
+    NSArray<ALTZipEntry *> *entries = [self zipEntriesInArchiveAtURL:sourceIPAURL error:error];
+    if (entries == nil)
+    {
+        return NO;
+    }
     
-    NSString *ipaName = [NSString stringWithFormat:@"%@.ipa", appName];
-    NSURL *ipaURL = [[appBundleURL URLByDeletingLastPathComponent] URLByAppendingPathComponent:ipaName];
+    zlib_filefunc_def filefunc;
+    fill_mmap_filefunc(&filefunc);
     
-    if ([self fileExistsAtPath:ipaURL.path])
+    unzFile sourceZipFile = unzOpen2(sourceIPAURL.fileSystemRepresentation, &filefunc);
+    if (sourceZipFile == NULL)
     {
-        if (![self removeItemAtURL:ipaURL error:error])
-        {
-            return nil;
-        }
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileNoSuchFileError userInfo:@{NSURLErrorKey: sourceIPAURL}];
+        return NO;
     }
     
     zipFile zipFile = zipOpen(ipaURL.fileSystemRepresentation, APPEND_STATUS_CREATE);
     if (zipFile == nil)
     {
         *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: ipaURL}];
-        return nil;
+        
+        unzClose(sourceZipFile);
+        return NO;
     }
     
-    NSURL *payloadDirectory = [NSURL fileURLWithPath:@"Payload" isDirectory:YES];
-    NSURL *appBundleDirectory = [payloadDirectory URLByAppendingPathComponent:appBundleFilename isDirectory:YES];
+    zipSetParallelDeflate(zipFile, (int)NSProcessInfo.processInfo.activeProcessorCount, ALTBlockDeflateBlockSize);
     
-    NSDirectoryEnumerator *countEnumerator = [self enumeratorAtURL:appBundleURL
-                                        includingPropertiesForKeys:@[]
-                                                           options:0
-                                                      errorHandler:^BOOL(NSURL * _Nonnull url, NSError * _Nonnull error) {
-                                                          if (error) {
-                                                              NSLog(@"[Error] %@ (%@)", error, url);
-                                                              return NO;
-                                                          }
-                                                          
-                                                          return YES;
-                                                      }];
+    NSMutableSet<NSString *> *remainingPaths = [NSMutableSet setWithArray:replacementItems.allKeys];
+    BOOL success = YES;
     
-    NSInteger totalCount = 0;
-    for (NSURL *__unused fileURL in countEnumerator)
+    // Entries keep their order in the source archive; only replaced files are compressed again.
+    for (ALTZipEntry *entry in entries)
     {
-        totalCount++;
-    }
-    
-    NSProgress *progress = [NSProgress progressWithTotalUnitCount:totalCount + 2]; // We add two extra entries at the end.
- 
-    NSDirectoryEnumerator *enumerator = [self enumeratorAtURL:appBundleURL
-                                   includingPropertiesForKeys:@[NSURLIsDirectoryKey]
-                                                      options:0
-                                                 errorHandler:^BOOL(NSURL * _Nonnull url, NSError * _Nonnull error) {
-        if (error) {
-            NSLog(@"[Error] %@ (%@)", error, url);
-            return NO;
+        NSData *data = replacementItems[entry.filename];
+        
+        if (data != nil)
+        {
+            [remainingPaths removeObject:entry.filename];
+            success = [self writeData:data toZipFile:zipFile filename:entry.filename externalAttributes:entry.info.external_fa error:error];
+        }
+        else
+        {
+            success = [self copyZipEntry:entry fromZipFile:sourceZipFile toZipFile:zipFile externalAttributes:entry.info.external_fa error:error];
         }
         
-        return YES;
-    }];
-    
-    BOOL success = YES;
-    
-    for (NSURL *fileURL in enumerator)
-    {
-        NSNumber *isDirectory = nil;
-        if (![fileURL getResourceValue:&isDirectory forKey:NSURLIsDirectoryKey error:error])
+        if (!success)
         {
-            success = NO;
             break;
         }
-        
-        if (![self writeItemAtURL:fileURL toZipFile:&zipFile depth:enumerator.level relativeURL:appBundleDirectory isDirectory:[isDirectory boolValue] error:error])
+    }
+    
+    // Files that didn't exist before signing (e.g. embedded.mobileprovision) go at the end.
+    for (NSString *filename in [remainingPaths.allObjects sortedArrayUsingSelector:@selector(compare:)])
+    {
+        if (!success)
         {
-            success = NO;
             break;
         }
         
-        progress.completedUnitCount += 1;
+        success = [self writeData:replacementItems[filename] toZipFile:zipFile filename:filename externalAttributes:(uLong)(S_IFREG | 0644) << 16 error:error];
     }
     
-    if (success)
+    // zipClose writes the entire central directory, so a failure here leaves an IPA nothing can read.
+    if (zipClose(zipFile, NULL) != ZIP_OK && success)
     {
-        if (![self writeItemAtURL:payloadDirectory toZipFile:&zipFile depth:1 relativeURL:nil isDirectory:YES error:error])
+        if (error)
         {
-            success = NO;
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: ipaURL}];
         }
         
-        progress.completedUnitCount += 1;
+        success = NO;
+    }
+    
+    unzClose(sourceZipFile);
+    
+    if (!success)
+    {
+        [self removeItemAtURL:ipaURL error:nil];
+    }
+    
+    return success;
+}
 
-        if (![self writeItemAtURL:appBundleDirectory toZipFile:&zipFile depth:2 relativeURL:nil isDirectory:YES error:error])
+- (BOOL)writeData:(NSData *)data toZipFile:(zipFile)zipFile filename:(NSString *)filename externalAttributes:(uLong)externalAttributes error:(NSError **)error
+{
+    zip_fileinfo fileInfo = {};
+    fileInfo.external_fa = externalAttributes;
+    
+    int zip64 = (data.length >= ALTZip64Threshold);
+    
+    if (zipOpenNewFileInZip64(zipFile, filename.fileSystemRepresentation, &fileInfo,
+                              NULL, 0, NULL, 0, NULL, Z_DEFLATED, ALTCompressionLevel, zip64) != ZIP_OK)
+    {
+        zipCloseFileInZip(zipFile);
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: filename}];
+        return NO;
+    }
+    
+    // Written in block-sized pieces so minizip can deflate large files in parallel (see zipSetParallelDeflate).
+    for (NSUInteger offset = 0; offset < data.length; offset += ALTBlockDeflateBlockSize)
+    {
+        NSUInteger length = MIN(data.length - offset, ALTBlockDeflateBlockSize);
+        
+        if (zipWriteInFileInZip(zipFile, (const char *)data.bytes + offset, (unsigned int)length) != ZIP_OK)
         {
-            success = NO;
+            zipCloseFileInZip(zipFile);
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: filename}];
+            return NO;
         }
-        
-        progress.completedUnitCount += 1;
     }
     
-    zipClose(zipFile, NULL);
+    if (zipCloseFileInZip(zipFile) != ZIP_OK)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: filename}];
+        return NO;
+    }
     
-    return success ? ipaURL : nil;
+    return YES;
 }
 
-- (BOOL)writeItemAtURL:(NSURL *)fileURL toZipFile:(zipFile *)zipFile depth:(NSInteger)depth relativeURL:(nullable NSURL *)relativeURL isDirectory:(BOOL)isDirectory error:(NSError **)error
+- (nullable ALTZipItem *)zipItemForItemAtURL:(NSURL *)fileURL depth:(NSInteger)depth relativeURL:(nullable NSURL *)relativeURL isDirectory:(BOOL)isDirectory
+                               sourceEntries:(nullable NSDictionary<NSString *, ALTZipEntry *> *)sourceEntries error:(NSError **)error
 {
     NSArray<NSString *> *components = fileURL.pathComponents;
     NSArray<NSString *> *relativeComponents = [components subarrayWithRange:NSMakeRange(components.count - depth, depth)];
@@ -351,8 +1118,9 @@ char ALTDirectoryDeliminator = '/';
         filename = relativePath;
     }
     
-    NSData *data = nil;
-    zip_fileinfo fileInfo = {};
+    ALTZipItem *item = [[ALTZipItem alloc] init];
+    item.fileURL = fileURL;
+    item.isDirectory = isDirectory;
     
     if (isDirectory)
     {
@@ -371,41 +1139,268 @@ char ALTDirectoryDeliminator = '/';
         NSDictionary *attributes = [self attributesOfItemAtPath:fileURL.path error:error];
         if (attributes == nil)
         {
-            return NO;
+            return nil;
         }
         
         NSNumber *permissionsValue = attributes[NSFilePosixPermissions];
         if (permissionsValue == nil)
         {
             *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSURLErrorKey: fileURL}];
-            return NO;
+            return nil;
         }
         
         short permissions = permissionsValue.shortValue;
         NSInteger shiftedPermissions = 0100000 + permissions;
         uLong permissionsLong = @(shiftedPermissions).unsignedLongValue;
         
-        fileInfo.external_fa = (unsigned int)(permissionsLong << 16L);
+        item.externalAttributes = permissionsLong << 16L;
+        item.uncompressedSize = [attributes fileSize];
+        
+        // Files whose size and modification time still match what was extracted haven't been touched,
+        // so their compressed bytes can be copied over as-is instead of being recompressed.
+        ALTZipEntry *sourceEntry = sourceEntries[filename];
+        if (sourceEntry != nil && sourceEntry.info.uncompressed_size == [attributes fileSize] &&
+            [attributes fileModificationDate].timeIntervalSince1970 == (NSTimeInterval)sourceEntry.modificationTime)
+        {
+            item.sourceEntry = sourceEntry;
+        }
+    }
+    
+    item.filename = filename;
+    
+    return item;
+}
+
+- (void)compressZipItem:(ALTZipItem *)item
+{
+    if (item.isDirectory || item.sourceEntry != nil || item.uncompressedSize >= ALTBlockDeflateThreshold)
+    {
+        return;
+    }
+    
+    NSError *error = nil;
+    NSData *data = [NSData dataWithContentsOfURL:item.fileURL options:NSDataReadingMappedIfSafe error:&error];
+    if (data == nil)
+    {
+        item.error = error;
+        return;
+    }
+    
+    // Match zipOpenNewFileInZip's deflate parameters so output is byte-for-byte what minizip would produce.
+    z_stream stream = {};
+    if (deflateInit2(&stream, ALTCompressionLevel, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        item.error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: item.fileURL}];
+        return;
+    }
+    
+    NSMutableData *compressedData = [NSMutableData dataWithLength:deflateBound(&stream, data.length)];
+    
+    stream.next_in = (Bytef *)data.bytes;
+    stream.avail_in = (uInt)data.length;
+    stream.next_out = (Bytef *)compressedData.mutableBytes;
+    stream.avail_out = (uInt)compressedData.length;
+    
+    int result = deflate(&stream, Z_FINISH);
+    
+    compressedData.length = stream.total_out;
+    int dataType = stream.data_type;
+    
+    deflateEnd(&stream);
+    
+    if (result != Z_STREAM_END)
+    {
+        item.error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: item.fileURL}];
+        return;
+    }
+    
+    item.compressedData = compressedData;
+    item.uncompressedSize = data.length;
+    item.crc = crc32(0, (const Bytef *)data.bytes, (uInt)data.length);
+    item.internalAttributes = (dataType == Z_ASCII) ? Z_ASCII : 0;
+}
+
+- (BOOL)writeZipItem:(ALTZipItem *)item toZipFile:(zipFile)zipFile sourceZipFile:(nullable unzFile)sourceZipFile buffer:(char *)buffer error:(NSError **)error
+{
+    if (item.sourceEntry != nil)
+    {
+        return [self copyZipEntry:item.sourceEntry fromZipFile:sourceZipFile toZipFile:zipFile externalAttributes:item.externalAttributes error:error];
+    }
+    
+    zip_fileinfo fileInfo = {};
+    fileInfo.external_fa = item.externalAttributes;
+    fileInfo.internal_fa = item.internalAttributes;
+    
+    if (item.isDirectory)
+    {
+        if (zipOpenNewFileInZip(zipFile, item.filename.fileSystemRepresentation, &fileInfo,
+                                NULL, 0, NULL, 0, NULL, Z_DEFLATED, ALTCompressionLevel) != ZIP_OK)
+        {
+            zipCloseFileInZip(zipFile);
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: item.filename}];
+            return NO;
+        }
         
-        data = [NSData dataWithContentsOfURL:fileURL options:0 error:error];
-        if (data == nil)
+        if (zipCloseFileInZip(zipFile) != ZIP_OK)
         {
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: item.filename}];
             return NO;
         }
+        
+        return YES;
     }
     
-    if (zipOpenNewFileInZip(*zipFile, filename.fileSystemRepresentation, &fileInfo,
-                            NULL, 0, NULL, 0, NULL, Z_DEFLATED, Z_DEFAULT_COMPRESSION) != ZIP_OK)
+    if (item.compressedData == nil)
     {
-        zipCloseFileInZip(*zipFile);
-        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: filename}];
+        return [self writeFileForZipItem:item toZipFile:zipFile buffer:buffer error:error];
+    }
+    
+    if (zipOpenNewFileInZip2(zipFile, item.filename.fileSystemRepresentation, &fileInfo,
+                             NULL, 0, NULL, 0, NULL, Z_DEFLATED, ALTCompressionLevel, 1) != ZIP_OK)
+    {
+        zipCloseFileInZipRaw(zipFile, item.uncompressedSize, item.crc);
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: item.filename}];
         return NO;
     }
     
-    if (zipWriteInFileInZip(*zipFile, data.bytes, (unsigned int)data.length) != ZIP_OK)
+    if (zipWriteInFileInZip(zipFile, item.compressedData.bytes, (unsigned int)item.compressedData.length) != ZIP_OK)
     {
-        zipCloseFileInZip(*zipFile);
-        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: filename}];
+        zipCloseFileInZipRaw(zipFile, item.uncompressedSize, item.crc);
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: item.filename}];
+        return NO;
+    }
+    
+    if (zipCloseFileInZipRaw(zipFile, item.uncompressedSize, item.crc) != ZIP_OK)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: item.filename}];
+        return NO;
+    }
+    
+    return YES;
+}
+
+- (BOOL)writeFileForZipItem:(ALTZipItem *)item toZipFile:(zipFile)zipFile buffer:(char *)buffer error:(NSError **)error
+{
+    FILE *inputFile = fopen(item.fileURL.fileSystemRepresentation, "rb");
+    if (inputFile == NULL)
+    {
+        NSError *underlyingError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSURLErrorKey: item.fileURL}];
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSURLErrorKey: item.fileURL, NSUnderlyingErrorKey: underlyingError}];
+        return NO;
+    }
+    
+    // Read straight into our buffer; stdio's own buffering would only add a copy.
+    setvbuf(inputFile, NULL, _IONBF, 0);
+    
+    zip_fileinfo fileInfo = {};
+    fileInfo.external_fa = item.externalAttributes;
+    
+    int zip64 = (item.uncompressedSize >= ALTZip64Threshold);
+    
+    // Large files go through minizip itself, which deflates them in parallel blocks (see zipSetParallelDeflate).
+    if (zipOpenNewFileInZip64(zipFile, item.filename.fileSystemRepresentation, &fileInfo,
+                              NULL, 0, NULL, 0, NULL, Z_DEFLATED, ALTCompressionLevel, zip64) != ZIP_OK)
+    {
+        zipCloseFileInZip(zipFile);
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: item.filename}];
+        
+        fclose(inputFile);
+        return NO;
+    }
+    
+    size_t length = 0;
+    
+    do
+    {
+        length = fread(buffer, 1, ALTBlockDeflateBlockSize, inputFile);
+        
+        if (length == 0 && ferror(inputFile))
+        {
+            zipCloseFileInZip(zipFile);
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSURLErrorKey: item.fileURL}];
+            
+            fclose(inputFile);
+            return NO;
+        }
+        
+        if (length > 0 && zipWriteInFileInZip(zipFile, buffer, (unsigned int)length) != ZIP_OK)
+        {
+            zipCloseFileInZip(zipFile);
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: item.filename}];
+            
+            fclose(inputFile);
+            return NO;
+        }
+        
+    } while (length > 0);
+    
+    fclose(inputFile);
+    
+    if (zipCloseFileInZip(zipFile) != ZIP_OK)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: item.filename}];
+        return NO;
+    }
+    
+    return YES;
+}
+
+- (BOOL)copyZipEntry:(ALTZipEntry *)entry fromZipFile:(unzFile)sourceZipFile toZipFile:(zipFile)zipFile externalAttributes:(uLong)externalAttributes error:(NSError **)error
+{
+    unz_file_pos position = entry.position;
+    
+    int method = 0;
+    int level = 0;
+    
+    if (unzGoToFilePos(sourceZipFile, &position) != UNZ_OK || unzOpenCurrentFile2(sourceZipFile, &method, &level, 1) != UNZ_OK)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSFilePathErrorKey: entry.filename}];
+        return NO;
+    }
+    
+    zip_fileinfo fileInfo = {};
+    fileInfo.tmz_date.tm_sec = entry.info.tmu_date.tm_sec;
+    fileInfo.tmz_date.tm_min = entry.info.tmu_date.tm_min;
+    fileInfo.tmz_date.tm_hour = entry.info.tmu_date.tm_hour;
+    fileInfo.tmz_date.tm_mday = entry.info.tmu_date.tm_mday;
+    fileInfo.tmz_date.tm_mon = entry.info.tmu_date.tm_mon;
+    fileInfo.tmz_date.tm_year = entry.info.tmu_date.tm_year;
+    fileInfo.internal_fa = entry.info.internal_fa;
+    fileInfo.external_fa = externalAttributes;
+    
+    int zip64 = (entry.info.compressed_size >= ALTZip64Threshold || entry.info.uncompressed_size >= ALTZip64Threshold);
+    
+    if (zipOpenNewFileInZip2_64(zipFile, entry.filename.fileSystemRepresentation, &fileInfo, NULL, 0, NULL, 0, NULL, method, level, 1, zip64) != ZIP_OK)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: entry.filename}];
+        
+        unzCloseCurrentFile(sourceZipFile);
+        return NO;
+    }
+    
+    char buffer[ALTReadBufferSize];
+    int result = UNZ_OK;
+    
+    do
+    {
+        result = unzReadCurrentFile(sourceZipFile, buffer, ALTReadBufferSize);
+        
+        if (result < 0 || (result > 0 && zipWriteInFileInZip(zipFile, buffer, result) != ZIP_OK))
+        {
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: entry.filename}];
+            
+            zipCloseFileInZipRaw(zipFile, entry.info.uncompressed_size, entry.info.crc);
+            unzCloseCurrentFile(sourceZipFile);
+            return NO;
+        }
+        
+    } while (result > 0);
+    
+    unzCloseCurrentFile(sourceZipFile);
+    
+    if (zipCloseFileInZipRaw(zipFile, entry.info.uncompressed_size, entry.info.crc) != ZIP_OK)
+    {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSFilePathErrorKey: entry.filename}];
         return NO;
     }
     
@@ -38,10 +38,22 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, copy, readonly) NSDictionary<ALTEntitlement, id> *entitlements;
 @property (nonatomic, copy, readonly) NSString *entitlementsString;
 
+// For applications read from an .ipa, this is the URL of the .ipa.
 @property (nonatomic, copy, readonly) NSURL *fileURL;
 
+// Path of the app bundle inside the .ipa (e.g. "Payload/App.app"), or nil if the application wasn't read from an .ipa.
+@property (nonatomic, copy, readonly, nullable) NSString *archiveBundlePath;
+
 - (nullable instancetype)initWithFileURL:(NSURL *)fileURL;
 
+// Reads metadata straight from the .ipa, without extracting the app bundle.
+- (nullable instancetype)initWithIPAURL:(NSURL *)ipaURL;
+
+// Applications created with -initWithFileURL: are cached per bundle and reused until its Info.plist, executable, embedded provisioning
+// profile, or app extensions change. Invalidate them after changing anything else in a bundle that they report.
++ (void)invalidateCachedApplicationAtURL:(NSURL *)fileURL;
++ (void)invalidateCachedApplications;
+
 @end
 
 NS_ASSUME_NONNULL_END
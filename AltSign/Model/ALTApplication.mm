@@ -8,9 +8,12 @@
 
 #import "ALTApplication.h"
 #import "ALTProvisioningProfile.h"
+#import "NSFileManager+Apps.h"
 
 #include "alt_ldid.hpp"
 
+#include <sys/stat.h>
+
 ALTDeviceType ALTDeviceTypeFromUIDeviceFamily(NSInteger deviceFamily)
 {
     switch (deviceFamily)
@@ -22,37 +25,226 @@ ALTDeviceType ALTDeviceTypeFromUIDeviceFamily(NSInteger deviceFamily)
     }
 }
 
+// Identifies one version of a file on disk. All zero if the file doesn't exist.
+typedef struct ALTFileVersion
+{
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modificationDate;
+} ALTFileVersion;
+
+static ALTFileVersion ALTFileVersionAtPath(NSString *path)
+{
+    ALTFileVersion version = {};
+    
+    struct stat info;
+    if (stat(path.fileSystemRepresentation, &info) == 0)
+    {
+        version.device = info.st_dev;
+        version.inode = info.st_ino;
+        version.size = info.st_size;
+        version.modificationDate = info.st_mtimespec;
+    }
+    
+    return version;
+}
+
+static BOOL ALTFileVersionEqualToVersion(ALTFileVersion version, ALTFileVersion otherVersion)
+{
+    return version.device == otherVersion.device && version.inode == otherVersion.inode && version.size == otherVersion.size &&
+           version.modificationDate.tv_sec == otherVersion.modificationDate.tv_sec && version.modificationDate.tv_nsec == otherVersion.modificationDate.tv_nsec;
+}
+
 @interface ALTApplication ()
+{
+    // Versions of what this application was read from, for applications created with -initWithFileURL:. provisioningProfile and
+    // appExtensions are read lazily, so the versions of embedded.mobileprovision and PlugIns/ are kept too.
+    ALTFileVersion _infoPlistVersion;
+    ALTFileVersion _executableVersion;
+    ALTFileVersion _provisioningProfileVersion;
+    ALTFileVersion _plugInsVersion;
+}
 
 @property (nonatomic, copy, nullable, readonly) NSString *iconName;
 
+// Set for applications read from an .ipa, in which case fileURL points to the .ipa.
+@property (nonatomic, copy, nullable, readonly) NSArray<NSString *> *archiveItemPaths;
+@property (nonatomic, copy, nullable, readonly) NSString *executableName;
+
 @end
 
 @implementation ALTApplication
 @synthesize entitlements = _entitlements;
 @synthesize entitlementsString = _entitlementsString;
 @synthesize provisioningProfile = _provisioningProfile;
+@synthesize appExtensions = _appExtensions;
+
++ (NSCache<NSString *, ALTApplication *> *)applicationCache
+{
+    static NSCache<NSString *, ALTApplication *> *applicationCache = nil;
+    
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        applicationCache = [[NSCache alloc] init];
+    });
+    
+    return applicationCache;
+}
+
++ (void)invalidateCachedApplicationAtURL:(NSURL *)fileURL
+{
+    [self.applicationCache removeObjectForKey:fileURL.URLByStandardizingPath.path];
+}
+
++ (void)invalidateCachedApplications
+{
+    [self.applicationCache removeAllObjects];
+}
 
 - (instancetype)initWithFileURL:(NSURL *)fileURL
 {
-    self = [super init];
+    NSString *bundlePath = fileURL.URLByStandardizingPath.path;
+    NSString *infoPlistPath = [bundlePath stringByAppendingPathComponent:@"Info.plist"];
+    
+    // Reuse the application read last time unless anything it reports has changed since.
+    ALTApplication *cachedApplication = [ALTApplication.applicationCache objectForKey:bundlePath];
+    if (cachedApplication != nil && [cachedApplication isUpToDateWithBundleAtPath:bundlePath])
+    {
+        self = cachedApplication;
+        return self;
+    }
+    
+    NSBundle *bundle = [NSBundle bundleWithURL:fileURL];
+    if (bundle == nil)
+    {
+        return nil;
+    }
+    
+    // Check the versions before reading, so a change made while reading still invalidates the cached copy.
+    ALTFileVersion infoPlistVersion = ALTFileVersionAtPath(infoPlistPath);
+    ALTFileVersion provisioningProfileVersion = ALTFileVersionAtPath([bundlePath stringByAppendingPathComponent:@"embedded.mobileprovision"]);
+    ALTFileVersion plugInsVersion = ALTFileVersionAtPath([bundlePath stringByAppendingPathComponent:@"PlugIns"]);
+    
+    // Load info dictionary directly from disk, since NSBundle caches values
+    // that might not reflect the updated values on disk (such as bundle identifier).
+    NSURL *infoPlistURL = [bundle.bundleURL URLByAppendingPathComponent:@"Info.plist"];
+    NSDictionary *infoDictionary = [NSDictionary dictionaryWithContentsOfURL:infoPlistURL];
+    if (infoDictionary == nil)
+    {
+        return nil;
+    }
+    
+    self = [self initWithInfoDictionary:infoDictionary fileURL:fileURL];
     if (self)
     {
-        NSBundle *bundle = [NSBundle bundleWithURL:fileURL];
-        if (bundle == nil)
+        _executableName = [infoDictionary[@"CFBundleExecutable"] copy];
+        
+        _infoPlistVersion = infoPlistVersion;
+        _executableVersion = ALTFileVersionAtPath([bundlePath stringByAppendingPathComponent:_executableName ?: @""]);
+        _provisioningProfileVersion = provisioningProfileVersion;
+        _plugInsVersion = plugInsVersion;
+        
+        [ALTApplication.applicationCache setObject:self forKey:bundlePath];
+    }
+    
+    return self;
+}
+
+- (BOOL)isUpToDateWithBundleAtPath:(NSString *)bundlePath
+{
+    if (!ALTFileVersionEqualToVersion(_infoPlistVersion, ALTFileVersionAtPath([bundlePath stringByAppendingPathComponent:@"Info.plist"])) ||
+        !ALTFileVersionEqualToVersion(_executableVersion, ALTFileVersionAtPath([bundlePath stringByAppendingPathComponent:self.executableName ?: @""])) ||
+        !ALTFileVersionEqualToVersion(_provisioningProfileVersion, ALTFileVersionAtPath([bundlePath stringByAppendingPathComponent:@"embedded.mobileprovision"])) ||
+        !ALTFileVersionEqualToVersion(_plugInsVersion, ALTFileVersionAtPath([bundlePath stringByAppendingPathComponent:@"PlugIns"])))
+    {
+        return NO;
+    }
+    
+    // PlugIns/ only changes version when extensions are added or removed, so check the ones already read for changes of their own.
+    NSSet<ALTApplication *> *appExtensions = nil;
+    @synchronized(self)
+    {
+        appExtensions = _appExtensions;
+    }
+    
+    for (ALTApplication *appExtension in appExtensions)
+    {
+        if (![appExtension isUpToDateWithBundleAtPath:appExtension.fileURL.URLByStandardizingPath.path])
         {
-            return nil;
+            return NO;
         }
-        
-        // Load info dictionary directly from disk, since NSBundle caches values
-        // that might not reflect the updated values on disk (such as bundle identifier).
-        NSURL *infoPlistURL = [bundle.bundleURL URLByAppendingPathComponent:@"Info.plist"];
-        NSDictionary *infoDictionary = [NSDictionary dictionaryWithContentsOfURL:infoPlistURL];
-        if (infoDictionary == nil)
+    }
+    
+    return YES;
+}
+
+- (nullable instancetype)initWithIPAURL:(NSURL *)ipaURL
+{
+    NSError *error = nil;
+    NSArray<NSString *> *itemPaths = [[NSFileManager defaultManager] pathsOfItemsInIPAAtURL:ipaURL error:&error];
+    if (itemPaths == nil)
+    {
+        NSLog(@"Error reading IPA: %@", error);
+        return nil;
+    }
+    
+    for (NSString *path in itemPaths)
+    {
+        NSArray<NSString *> *components = [path componentsSeparatedByString:@"/"];
+        if (components.count == 3 && [components[0] isEqualToString:@"Payload"] &&
+            [components[1].pathExtension.lowercaseString isEqualToString:@"app"] && [components[2] isEqualToString:@"Info.plist"])
         {
-            return nil;
+            NSString *bundlePath = [path stringByDeletingLastPathComponent];
+            
+            self = [self initWithIPAURL:ipaURL bundlePath:bundlePath itemPaths:itemPaths];
+            return self;
         }
-        
+    }
+    
+    return nil;
+}
+
+- (nullable instancetype)initWithIPAURL:(NSURL *)ipaURL bundlePath:(NSString *)bundlePath itemPaths:(NSArray<NSString *> *)itemPaths
+{
+    NSString *infoPlistPath = [bundlePath stringByAppendingPathComponent:@"Info.plist"];
+    
+    NSError *error = nil;
+    NSDictionary<NSString *, NSData *> *contents = [[NSFileManager defaultManager] contentsOfItemsAtPaths:@[infoPlistPath] inIPAAtURL:ipaURL error:&error];
+    if (contents == nil)
+    {
+        NSLog(@"Error reading IPA: %@", error);
+        return nil;
+    }
+    
+    NSData *infoPlistData = contents[infoPlistPath];
+    if (infoPlistData == nil)
+    {
+        return nil;
+    }
+    
+    NSDictionary *infoDictionary = [NSPropertyListSerialization propertyListWithData:infoPlistData options:0 format:nil error:nil];
+    if (![infoDictionary isKindOfClass:[NSDictionary class]])
+    {
+        return nil;
+    }
+    
+    self = [self initWithInfoDictionary:infoDictionary fileURL:ipaURL];
+    if (self)
+    {
+        _archiveBundlePath = [bundlePath copy];
+        _archiveItemPaths = [itemPaths copy];
+        _executableName = [infoDictionary[@"CFBundleExecutable"] copy];
+    }
+    
+    return self;
+}
+
+- (nullable instancetype)initWithInfoDictionary:(NSDictionary *)infoDictionary fileURL:(NSURL *)fileURL
+{
+    self = [super init];
+    if (self)
+    {
         NSString *name = infoDictionary[@"CFBundleDisplayName"] ?: infoDictionary[(NSString *)kCFBundleNameKey];
         NSString *bundleIdentifier = infoDictionary[(NSString *)kCFBundleIdentifierKey];
                 
@@ -154,57 +346,204 @@ ALTDeviceType ALTDeviceTypeFromUIDeviceFamily(NSInteger deviceFamily)
 
 - (NSDictionary<ALTEntitlement,id> *)entitlements
 {
-    if (_entitlements == nil)
+    // Cached applications are shared between threads, so compute lazily loaded values once under a lock.
+    @synchronized(self)
     {
-        NSDictionary<NSString *, id> *appEntitlements = @{};
+        if (_entitlements == nil)
+        {
+            __block NSDictionary<NSString *, id> *appEntitlements = @{};
+            
+            // Parse the entitlements straight from the executable's code signature rather than from entitlementsString,
+            // which would copy them out and re-encode them first.
+            [self readRawEntitlements:^(const char *bytes, size_t length) {
+                if (length == 0)
+                {
+                    return;
+                }
+                
+                // Stop at the first NUL, same as entitlementsString.
+                NSData *entitlementsData = [NSData dataWithBytes:bytes length:strnlen(bytes, length)];
+                
+                NSError *error = nil;
+                NSDictionary *entitlements = [NSPropertyListSerialization propertyListWithData:entitlementsData options:0 format:nil error:&error];
+                
+                if (entitlements != nil)
+                {
+                    appEntitlements = entitlements;
+                }
+                else
+                {
+                    NSLog(@"Error parsing entitlements: %@", error);
+                }
+            }];
+            
+            _entitlements = appEntitlements;
+        }
         
-        if (self.entitlementsString.length != 0)
+        return _entitlements;
+    }
+}
+
+- (NSString *)entitlementsString
+{
+    @synchronized(self)
+    {
+        if (_entitlementsString == nil)
         {
-            NSData *entitlementsData = [self.entitlementsString dataUsingEncoding:NSUTF8StringEncoding];
+            __block NSString *entitlementsString = @"";
+            
+            [self readRawEntitlements:^(const char *bytes, size_t length) {
+                if (length == 0)
+                {
+                    return;
+                }
+                
+                // Stop at the first NUL, like the C string this used to be built from.
+                entitlementsString = [[NSString alloc] initWithBytes:bytes length:strnlen(bytes, length) encoding:NSUTF8StringEncoding] ?: @"";
+            }];
             
-            NSError *error = nil;
-            NSDictionary *entitlements = [NSPropertyListSerialization propertyListWithData:entitlementsData options:0 format:nil error:&error];
+            _entitlementsString = entitlementsString;
+        }
+        
+        return _entitlementsString;
+    }
+}
+
+// Calls handler with the executable's raw entitlements while the memory backing them is still alive. Empty if there are none,
+// or if the executable can't be parsed; ldid throws C++ exceptions, which mustn't unwind into Objective-C callers.
+- (void)readRawEntitlements:(void (^)(const char *bytes, size_t length))handler
+{
+    if (self.archiveBundlePath != nil)
+    {
+        if (self.executableName == nil)
+        {
+            handler(NULL, 0);
+            return;
+        }
+        
+        NSString *executablePath = [self.archiveBundlePath stringByAppendingPathComponent:self.executableName];
+        
+        NSError *error = nil;
+        NSData *executableData = [[NSFileManager defaultManager] codeSignatureContentsOfExecutableAtPath:executablePath inIPAAtURL:self.fileURL error:&error];
+        if (executableData == nil)
+        {
+            NSLog(@"Error reading executable: %@", error);
             
-            if (entitlements != nil)
+            handler(NULL, 0);
+            return;
+        }
+        
+        std::pair<const char *, size_t> entitlements(NULL, 0);
+        
+        try
+        {
+            entitlements = ldid::EntitlementsRange(executableData.bytes, executableData.length);
+        }
+        catch (...)
+        {
+            NSLog(@"[Error] Failed to read entitlements of %@ in %@", executablePath, self.fileURL);
+        }
+        
+        handler(entitlements.first, entitlements.second);
+    }
+    else
+    {
+        // Index the executable here rather than through ldid::ReadEntitlements, so only ldid's own errors are caught, not handler's.
+        std::unique_ptr<ldid::MachOIndex> index;
+        std::pair<const char *, size_t> entitlements(NULL, 0);
+        
+        try
+        {
+            index.reset(new ldid::MachOIndex(self.fileURL.fileSystemRepresentation));
+            entitlements = index->Entitlements();
+        }
+        catch (...)
+        {
+            NSLog(@"[Error] Failed to read entitlements of %@", self.fileURL);
+        }
+        
+        handler(entitlements.first, entitlements.second);
+    }
+}
+
+- (ALTProvisioningProfile *)provisioningProfile
+{
+    @synchronized(self)
+    {
+        if (_provisioningProfile == nil)
+        {
+            if (self.archiveBundlePath != nil)
             {
-                appEntitlements = entitlements;
+                NSString *provisioningProfilePath = [self.archiveBundlePath stringByAppendingPathComponent:@"embedded.mobileprovision"];
+                
+                NSDictionary<NSString *, NSData *> *contents = [[NSFileManager defaultManager] contentsOfItemsAtPaths:@[provisioningProfilePath] inIPAAtURL:self.fileURL error:nil];
+                NSData *provisioningProfileData = contents[provisioningProfilePath];
+                
+                if (provisioningProfileData != nil)
+                {
+                    _provisioningProfile = [[ALTProvisioningProfile alloc] initWithData:provisioningProfileData];
+                }
             }
             else
             {
-                NSLog(@"Error parsing entitlements: %@", error);
+                NSURL *provisioningProfileURL = [self.fileURL URLByAppendingPathComponent:@"embedded.mobileprovision"];
+                _provisioningProfile = [[ALTProvisioningProfile alloc] initWithURL:provisioningProfileURL];
             }
         }
         
-        _entitlements = appEntitlements;
+        return _provisioningProfile;
     }
-    
-    return _entitlements;
 }
 
-- (NSString *)entitlementsString
+- (NSSet<ALTApplication *> *)appExtensions
 {
-    if (_entitlementsString == nil)
+    @synchronized(self)
     {
-        std::string rawEntitlements = ldid::Entitlements(self.fileURL.fileSystemRepresentation);
-        _entitlementsString = @(rawEntitlements.c_str());
+        if (_appExtensions == nil)
+        {
+            _appExtensions = [self readAppExtensions];
+        }
+        
+        return _appExtensions;
     }
-    
-    return _entitlementsString;
 }
 
-- (ALTProvisioningProfile *)provisioningProfile
+- (NSSet<ALTApplication *> *)readAppExtensions
 {
-    if (_provisioningProfile == nil)
+    if (self.archiveBundlePath != nil)
     {
-        NSURL *provisioningProfileURL = [self.fileURL URLByAppendingPathComponent:@"embedded.mobileprovision"];
-        _provisioningProfile = [[ALTProvisioningProfile alloc] initWithURL:provisioningProfileURL];
+        NSMutableSet *appExtensions = [NSMutableSet set];
+        
+        // Extensions are found by their Info.plist, which sits directly inside PlugIns/*.appex.
+        NSString *plugInsPath = [self.archiveBundlePath stringByAppendingString:@"/PlugIns/"];
+        
+        for (NSString *path in self.archiveItemPaths)
+        {
+            if (![path hasPrefix:plugInsPath])
+            {
+                continue;
+            }
+            
+            NSArray<NSString *> *components = [[path substringFromIndex:plugInsPath.length] componentsSeparatedByString:@"/"];
+            if (components.count != 2 || ![components[0].pathExtension.lowercaseString isEqualToString:@"appex"] || ![components[1] isEqualToString:@"Info.plist"])
+            {
+                continue;
+            }
+            
+            NSString *bundlePath = [plugInsPath stringByAppendingString:components[0]];
+            
+            ALTApplication *appExtension = [[ALTApplication alloc] initWithIPAURL:self.fileURL bundlePath:bundlePath itemPaths:self.archiveItemPaths];
+            if (appExtension == nil)
+            {
+                continue;
+            }
+            
+            [appExtensions addObject:appExtension];
+        }
+        
+        return appExtensions;
     }
     
-    return _provisioningProfile;
-}
-
-- (NSSet<ALTApplication *> *)appExtensions
-{
     NSBundle *bundle = [NSBundle bundleWithURL:self.fileURL];
     
     NSMutableSet *appExtensions = [NSMutableSet set];
@@ -0,0 +1,61 @@
+//
+//  ALTApplicationCatalog.h
+//  AltSign
+//
+//  Created by Riley Testut on 10/16/26.
+//  Copyright © 2026 Riley Testut. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "ALTCapabilities.h"
+#import "ALTDevice.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface ALTApplicationCatalogEntry : NSObject
+
+@property (nonatomic, copy, readonly) NSURL *fileURL;
+
+@property (nonatomic, copy, readonly) NSString *bundleIdentifier;
+@property (nonatomic, copy, readonly) NSString *version;
+
+@property (nonatomic, readonly) NSOperatingSystemVersion minimumiOSVersion;
+@property (nonatomic, readonly) ALTDeviceType supportedDeviceTypes;
+
+@property (nonatomic, copy, readonly) NSSet<ALTEntitlement> *entitlements;
+
+// Nil if the .ipa has no embedded provisioning profile.
+@property (nonatomic, copy, readonly, nullable) NSUUID *profileUUID;
+@property (nonatomic, copy, readonly, nullable) NSString *teamIdentifier;
+@property (nonatomic, copy, readonly, nullable) NSDate *profileExpirationDate;
+
+// SHA-256 of the .ipa.
+@property (nonatomic, copy, readonly) NSData *contentHash;
+
+@end
+
+// Metadata for a library of .ipas, kept in a file that's memory-mapped and queried in place,
+// so answering questions about thousands of apps doesn't mean opening any of them.
+@interface ALTApplicationCatalog : NSObject
+
+@property (nonatomic, copy, readonly) NSURL *fileURL;
+@property (nonatomic, readonly) NSInteger count;
+
+// Opens the catalog at fileURL, or an empty one if nothing has been saved there yet.
+- (nullable instancetype)initWithFileURL:(NSURL *)fileURL error:(NSError **)error;
+
+// Reads every .ipa that's new or whose size or modification date changed since it was last read, then saves the catalog.
+// Files that can't be read as apps are left out.
+- (BOOL)updateWithIPAsAtURLs:(NSArray<NSURL *> *)ipaURLs error:(NSError **)error;
+- (BOOL)removeIPAsAtURLs:(NSArray<NSURL *> *)ipaURLs error:(NSError **)error;
+
+- (nullable ALTApplicationCatalogEntry *)entryForIPAAtURL:(NSURL *)ipaURL;
+
+- (NSArray<ALTApplicationCatalogEntry *> *)entriesForTeamIdentifier:(NSString *)teamIdentifier;
+- (NSArray<ALTApplicationCatalogEntry *> *)entriesExpiringBeforeDate:(NSDate *)date;
+- (NSArray<ALTApplicationCatalogEntry *> *)entriesWithEntitlement:(ALTEntitlement)entitlement;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,733 @@
+//
+//  ALTApplicationCatalog.mm
+//  AltSign
+//
+//  Created by Riley Testut on 10/16/26.
+//  Copyright © 2026 Riley Testut. All rights reserved.
+//
+
+#import "ALTApplicationCatalog.h"
+#import "ALTApplication.h"
+#import "ALTProvisioningProfile.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <openssl/sha.h>
+
+// Catalog files start with this header, followed by recordCount records sorted by path, entitlementCount string IDs
+// that records' entitlements index into (padded to a multiple of 8 bytes), stringCount offsets into the string data, and finally
+// the string data itself: every string exactly once, NUL-terminated and sorted, so a string's ID is its rank and lookups are binary searches.
+struct ALTCatalogHeader
+{
+    char magic[8];
+    uint32_t recordCount;
+    uint32_t entitlementCount;
+    uint32_t stringCount;
+    uint32_t reserved;
+    uint64_t stringDataSize;
+};
+
+static const char ALTCatalogMagic[8] = {'A', 'L', 'T', 'C', 'A', 'T', 'L', '1'};
+
+enum ALTCatalogRecordFlags : uint32_t
+{
+    ALTCatalogRecordFlagHasProfile = 1 << 0,
+};
+
+// Fixed-width, so records can be read straight out of the mapped file.
+struct ALTCatalogRecord
+{
+    uint64_t fileSize;
+    int64_t modificationTime;
+    int64_t profileExpirationDate;
+
+    // String IDs.
+    uint32_t path;
+    uint32_t bundleIdentifier;
+    uint32_t version;
+    uint32_t teamIdentifier;
+
+    // Sorted string IDs of the entitlement keys, in the entitlement table.
+    uint32_t entitlementsIndex;
+    uint32_t entitlementsCount;
+
+    uint32_t flags;
+    uint16_t minimumOSVersion[3];
+    uint16_t supportedDeviceTypes;
+
+    uint8_t profileUUID[16];
+    uint8_t contentHash[SHA256_DIGEST_LENGTH];
+
+    uint32_t reserved;
+};
+
+static_assert(sizeof(ALTCatalogRecord) == 112, "ALTCatalogRecord must have the same layout everywhere");
+static_assert(sizeof(ALTCatalogHeader) % 8 == 0 && sizeof(ALTCatalogRecord) % 8 == 0, "string offsets must stay 8-byte aligned");
+
+// Size of the entitlement table, including the padding that keeps the 64-bit string offsets after it aligned.
+static uint64_t ALTCatalogEntitlementTableSize(uint32_t entitlementCount)
+{
+    return ((uint64_t)entitlementCount * sizeof(uint32_t) + 7) & ~(uint64_t)7;
+}
+
+// Everything a record holds, with strings instead of string IDs, for rebuilding the catalog.
+struct ALTCatalogItem
+{
+    std::string path;
+    std::string bundleIdentifier;
+    std::string version;
+    std::string teamIdentifier;
+    std::vector<std::string> entitlements;
+
+    ALTCatalogRecord record;
+};
+
+// Modification time in nanoseconds, which is what records store.
+static int64_t ALTCatalogModificationTime(const struct stat &info)
+{
+    return (int64_t)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+}
+
+@interface ALTApplicationCatalogEntry ()
+
+- (instancetype)initWithFileURL:(NSURL *)fileURL bundleIdentifier:(NSString *)bundleIdentifier version:(NSString *)version
+              minimumiOSVersion:(NSOperatingSystemVersion)minimumiOSVersion supportedDeviceTypes:(ALTDeviceType)supportedDeviceTypes
+                   entitlements:(NSSet<ALTEntitlement> *)entitlements profileUUID:(nullable NSUUID *)profileUUID
+                 teamIdentifier:(nullable NSString *)teamIdentifier profileExpirationDate:(nullable NSDate *)profileExpirationDate
+                    contentHash:(NSData *)contentHash;
+
+@end
+
+@implementation ALTApplicationCatalogEntry
+
+- (instancetype)initWithFileURL:(NSURL *)fileURL bundleIdentifier:(NSString *)bundleIdentifier version:(NSString *)version
+              minimumiOSVersion:(NSOperatingSystemVersion)minimumiOSVersion supportedDeviceTypes:(ALTDeviceType)supportedDeviceTypes
+                   entitlements:(NSSet<ALTEntitlement> *)entitlements profileUUID:(NSUUID *)profileUUID
+                 teamIdentifier:(NSString *)teamIdentifier profileExpirationDate:(NSDate *)profileExpirationDate
+                    contentHash:(NSData *)contentHash
+{
+    self = [super init];
+    if (self)
+    {
+        _fileURL = [fileURL copy];
+        _bundleIdentifier = [bundleIdentifier copy];
+        _version = [version copy];
+        _minimumiOSVersion = minimumiOSVersion;
+        _supportedDeviceTypes = supportedDeviceTypes;
+        _entitlements = [entitlements copy];
+        _profileUUID = [profileUUID copy];
+        _teamIdentifier = [teamIdentifier copy];
+        _profileExpirationDate = [profileExpirationDate copy];
+        _contentHash = [contentHash copy];
+    }
+
+    return self;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p, Bundle ID: %@, Version: %@, Team ID: %@>", NSStringFromClass(self.class), self, self.bundleIdentifier, self.version, self.teamIdentifier];
+}
+
+@end
+
+@interface ALTApplicationCatalog ()
+
+@property (nonatomic) NSData *data;
+
+@end
+
+@implementation ALTApplicationCatalog
+
+- (instancetype)initWithFileURL:(NSURL *)fileURL error:(NSError **)error
+{
+    self = [super init];
+    if (self)
+    {
+        _fileURL = [fileURL copy];
+
+        if ([[NSFileManager defaultManager] fileExistsAtPath:fileURL.path])
+        {
+            NSData *data = [NSData dataWithContentsOfURL:fileURL options:NSDataReadingMappedAlways error:error];
+            if (data == nil)
+            {
+                return nil;
+            }
+
+            if (![ALTApplicationCatalog isValidCatalogData:data])
+            {
+                if (error)
+                {
+                    *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:@{NSURLErrorKey: fileURL}];
+                }
+
+                return nil;
+            }
+
+            _data = data;
+        }
+    }
+
+    return self;
+}
+
+#pragma mark - Reading -
+
+// Checks every count, offset, and string ID once up front, so queries can trust the mapped file.
++ (BOOL)isValidCatalogData:(NSData *)data
+{
+    if (data.length < sizeof(ALTCatalogHeader))
+    {
+        return NO;
+    }
+
+    const ALTCatalogHeader *header = (const ALTCatalogHeader *)data.bytes;
+    if (memcmp(header->magic, ALTCatalogMagic, sizeof(ALTCatalogMagic)) != 0)
+    {
+        return NO;
+    }
+
+    // stringDataSize comes straight from the file and could wrap a sum around, so take each section out of what's left instead.
+    uint64_t sectionSizes[] = { (uint64_t)header->recordCount * sizeof(ALTCatalogRecord), ALTCatalogEntitlementTableSize(header->entitlementCount), (uint64_t)header->stringCount * sizeof(uint64_t) };
+    uint64_t remainingSize = data.length - sizeof(ALTCatalogHeader);
+
+    for (uint64_t sectionSize : sectionSizes)
+    {
+        if (sectionSize > remainingSize)
+        {
+            return NO;
+        }
+
+        remainingSize -= sectionSize;
+    }
+
+    if (header->stringDataSize != remainingSize)
+    {
+        return NO;
+    }
+
+    const uint8_t *bytes = (const uint8_t *)data.bytes;
+    const ALTCatalogRecord *records = (const ALTCatalogRecord *)(bytes + sizeof(ALTCatalogHeader));
+    const uint32_t *entitlements = (const uint32_t *)(records + header->recordCount);
+    const uint64_t *stringOffsets = (const uint64_t *)((const uint8_t *)entitlements + ALTCatalogEntitlementTableSize(header->entitlementCount));
+    const char *stringData = (const char *)(stringOffsets + header->stringCount);
+
+    if (header->stringDataSize > 0 && stringData[header->stringDataSize - 1] != '\0')
+    {
+        return NO;
+    }
+
+    for (uint32_t index = 0; index < header->stringCount; index++)
+    {
+        if (stringOffsets[index] >= header->stringDataSize)
+        {
+            return NO;
+        }
+
+        // IDForString: binary searches the strings, so they must be strictly increasing.
+        if (index > 0 && strcmp(stringData + stringOffsets[index - 1], stringData + stringOffsets[index]) >= 0)
+        {
+            return NO;
+        }
+    }
+
+    for (uint32_t index = 0; index < header->entitlementCount; index++)
+    {
+        if (entitlements[index] >= header->stringCount)
+        {
+            return NO;
+        }
+    }
+
+    for (uint32_t index = 0; index < header->recordCount; index++)
+    {
+        const ALTCatalogRecord &record = records[index];
+        if (record.path >= header->stringCount || record.bundleIdentifier >= header->stringCount || record.version >= header->stringCount || record.teamIdentifier >= header->stringCount)
+        {
+            return NO;
+        }
+
+        if ((uint64_t)record.entitlementsIndex + record.entitlementsCount > header->entitlementCount)
+        {
+            return NO;
+        }
+
+        // entryForIPAAtURL: and entriesWithEntitlement: binary search on these too. Since string IDs are ranks, comparing IDs is enough.
+        if (index > 0 && records[index - 1].path >= record.path)
+        {
+            return NO;
+        }
+
+        for (uint32_t entitlement = 1; entitlement < record.entitlementsCount; entitlement++)
+        {
+            if (entitlements[record.entitlementsIndex + entitlement - 1] >= entitlements[record.entitlementsIndex + entitlement])
+            {
+                return NO;
+            }
+        }
+    }
+
+    return YES;
+}
+
+- (const ALTCatalogHeader *)header
+{
+    return (const ALTCatalogHeader *)self.data.bytes;
+}
+
+- (const ALTCatalogRecord *)records
+{
+    return (const ALTCatalogRecord *)((const uint8_t *)self.data.bytes + sizeof(ALTCatalogHeader));
+}
+
+- (const uint32_t *)entitlementIDs
+{
+    return (const uint32_t *)(self.records + self.header->recordCount);
+}
+
+- (const uint64_t *)stringOffsets
+{
+    return (const uint64_t *)((const uint8_t *)self.entitlementIDs + ALTCatalogEntitlementTableSize(self.header->entitlementCount));
+}
+
+- (const char *)stringWithID:(uint32_t)stringID
+{
+    const uint64_t *stringOffsets = self.stringOffsets;
+    const char *stringData = (const char *)(stringOffsets + self.header->stringCount);
+
+    return stringData + stringOffsets[stringID];
+}
+
+// Returns UINT32_MAX if string isn't in the catalog at all, in which case nothing can match it.
+- (uint32_t)IDForString:(const char *)string
+{
+    if (self.data == nil)
+    {
+        return UINT32_MAX;
+    }
+
+    uint32_t lower = 0;
+    uint32_t upper = self.header->stringCount;
+
+    while (lower < upper)
+    {
+        uint32_t middle = lower + (upper - lower) / 2;
+
+        int comparison = strcmp([self stringWithID:middle], string);
+        if (comparison == 0)
+        {
+            return middle;
+        }
+        else if (comparison < 0)
+        {
+            lower = middle + 1;
+        }
+        else
+        {
+            upper = middle;
+        }
+    }
+
+    return UINT32_MAX;
+}
+
+- (NSInteger)count
+{
+    @synchronized(self)
+    {
+        return (self.data != nil) ? self.header->recordCount : 0;
+    }
+}
+
+- (ALTApplicationCatalogEntry *)entryForRecord:(const ALTCatalogRecord &)record
+{
+    NSMutableSet<ALTEntitlement> *entitlements = [NSMutableSet setWithCapacity:record.entitlementsCount];
+    for (uint32_t index = 0; index < record.entitlementsCount; index++)
+    {
+        [entitlements addObject:@([self stringWithID:self.entitlementIDs[record.entitlementsIndex + index]])];
+    }
+
+    NSOperatingSystemVersion minimumiOSVersion;
+    minimumiOSVersion.majorVersion = record.minimumOSVersion[0];
+    minimumiOSVersion.minorVersion = record.minimumOSVersion[1];
+    minimumiOSVersion.patchVersion = record.minimumOSVersion[2];
+
+    NSUUID *profileUUID = nil;
+    NSString *teamIdentifier = nil;
+    NSDate *profileExpirationDate = nil;
+
+    if (record.flags & ALTCatalogRecordFlagHasProfile)
+    {
+        profileUUID = [[NSUUID alloc] initWithUUIDBytes:record.profileUUID];
+        teamIdentifier = @([self stringWithID:record.teamIdentifier]);
+        profileExpirationDate = [NSDate dateWithTimeIntervalSince1970:record.profileExpirationDate];
+    }
+
+    NSURL *fileURL = [NSURL fileURLWithPath:@([self stringWithID:record.path])];
+    NSData *contentHash = [NSData dataWithBytes:record.contentHash length:sizeof(record.contentHash)];
+
+    ALTApplicationCatalogEntry *entry = [[ALTApplicationCatalogEntry alloc] initWithFileURL:fileURL bundleIdentifier:@([self stringWithID:record.bundleIdentifier])
+                                                                                    version:@([self stringWithID:record.version]) minimumiOSVersion:minimumiOSVersion
+                                                                       supportedDeviceTypes:(ALTDeviceType)record.supportedDeviceTypes entitlements:entitlements
+                                                                                profileUUID:profileUUID teamIdentifier:teamIdentifier
+                                                                      profileExpirationDate:profileExpirationDate contentHash:contentHash];
+    return entry;
+}
+
+// Scans every record in place, only creating entries for the ones that match.
+- (NSArray<ALTApplicationCatalogEntry *> *)entriesPassingTest:(BOOL (^)(const ALTCatalogRecord &record))predicate
+{
+    @synchronized(self)
+    {
+        NSMutableArray<ALTApplicationCatalogEntry *> *entries = [NSMutableArray array];
+
+        if (self.data == nil)
+        {
+            return entries;
+        }
+
+        const ALTCatalogRecord *records = self.records;
+        for (uint32_t index = 0; index < self.header->recordCount; index++)
+        {
+            if (predicate(records[index]))
+            {
+                [entries addObject:[self entryForRecord:records[index]]];
+            }
+        }
+
+        return entries;
+    }
+}
+
+- (ALTApplicationCatalogEntry *)entryForIPAAtURL:(NSURL *)ipaURL
+{
+    @synchronized(self)
+    {
+        uint32_t pathID = [self IDForString:ipaURL.URLByStandardizingPath.path.fileSystemRepresentation];
+        if (pathID == UINT32_MAX)
+        {
+            return nil;
+        }
+
+        // Records are sorted by path, and string IDs are in sorted order too.
+        const ALTCatalogRecord *records = self.records;
+        const ALTCatalogRecord *end = records + self.header->recordCount;
+
+        const ALTCatalogRecord *record = std::lower_bound(records, end, pathID, [](const ALTCatalogRecord &candidate, uint32_t pathID) {
+            return candidate.path < pathID;
+        });
+
+        if (record == end || record->path != pathID)
+        {
+            return nil;
+        }
+
+        return [self entryForRecord:*record];
+    }
+}
+
+- (NSArray<ALTApplicationCatalogEntry *> *)entriesForTeamIdentifier:(NSString *)teamIdentifier
+{
+    // String IDs are only valid for the mapping they came from, so look them up under the same lock as the scan.
+    @synchronized(self)
+    {
+        uint32_t teamID = [self IDForString:teamIdentifier.UTF8String];
+        if (teamID == UINT32_MAX)
+        {
+            return @[];
+        }
+
+        return [self entriesPassingTest:^BOOL(const ALTCatalogRecord &record) {
+            return (record.flags & ALTCatalogRecordFlagHasProfile) && record.teamIdentifier == teamID;
+        }];
+    }
+}
+
+- (NSArray<ALTApplicationCatalogEntry *> *)entriesExpiringBeforeDate:(NSDate *)date
+{
+    int64_t expirationDate = (int64_t)date.timeIntervalSince1970;
+
+    return [self entriesPassingTest:^BOOL(const ALTCatalogRecord &record) {
+        return (record.flags & ALTCatalogRecordFlagHasProfile) && record.profileExpirationDate < expirationDate;
+    }];
+}
+
+- (NSArray<ALTApplicationCatalogEntry *> *)entriesWithEntitlement:(ALTEntitlement)entitlement
+{
+    @synchronized(self)
+    {
+        uint32_t entitlementID = [self IDForString:entitlement.UTF8String];
+        if (entitlementID == UINT32_MAX)
+        {
+            return @[];
+        }
+
+        const uint32_t *entitlementIDs = self.entitlementIDs;
+        return [self entriesPassingTest:^BOOL(const ALTCatalogRecord &record) {
+            const uint32_t *begin = entitlementIDs + record.entitlementsIndex;
+            return std::binary_search(begin, begin + record.entitlementsCount, entitlementID);
+        }];
+    }
+}
+
+#pragma mark - Updating -
+
+- (BOOL)updateWithIPAsAtURLs:(NSArray<NSURL *> *)ipaURLs error:(NSError **)error
+{
+    @synchronized(self)
+    {
+        std::map<std::string, ALTCatalogItem> items = [self items];
+
+        NSMutableArray<NSURL *> *staleURLs = [NSMutableArray array];
+        std::vector<struct stat> staleInfo;
+
+        for (NSURL *ipaURL in ipaURLs)
+        {
+            NSURL *fileURL = ipaURL.URLByStandardizingPath;
+            std::string path = fileURL.path.fileSystemRepresentation;
+
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0)
+            {
+                items.erase(path);
+                continue;
+            }
+
+            auto item = items.find(path);
+            if (item != items.end() && item->second.record.fileSize == (uint64_t)info.st_size && item->second.record.modificationTime == ALTCatalogModificationTime(info))
+            {
+                // Unchanged since it was last read.
+                continue;
+            }
+
+            [staleURLs addObject:fileURL];
+            staleInfo.push_back(info);
+        }
+
+        std::vector<ALTCatalogItem> staleItems(staleURLs.count);
+        std::vector<char> readItems(staleURLs.count, false);
+
+        // Blocks capture C++ objects by copy, so hand the vectors over by pointer.
+        ALTCatalogItem *staleItemsPointer = staleItems.data();
+        char *readItemsPointer = readItems.data();
+        const struct stat *staleInfoPointer = staleInfo.data();
+
+        dispatch_apply(staleURLs.count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t index) {
+            @autoreleasepool
+            {
+                readItemsPointer[index] = [ALTApplicationCatalog readItem:&staleItemsPointer[index] fromIPAAtURL:staleURLs[index] info:staleInfoPointer[index]];
+            }
+        });
+
+        for (size_t index = 0; index < staleItems.size(); index++)
+        {
+            std::string path = staleURLs[index].path.fileSystemRepresentation;
+
+            if (readItems[index])
+            {
+                items[path] = std::move(staleItems[index]);
+            }
+            else
+            {
+                items.erase(path);
+            }
+        }
+
+        return [self writeItems:items error:error];
+    }
+}
+
+- (BOOL)removeIPAsAtURLs:(NSArray<NSURL *> *)ipaURLs error:(NSError **)error
+{
+    @synchronized(self)
+    {
+        std::map<std::string, ALTCatalogItem> items = [self items];
+
+        for (NSURL *ipaURL in ipaURLs)
+        {
+            items.erase(ipaURL.URLByStandardizingPath.path.fileSystemRepresentation);
+        }
+
+        return [self writeItems:items error:error];
+    }
+}
+
++ (BOOL)readItem:(ALTCatalogItem *)item fromIPAAtURL:(NSURL *)ipaURL info:(const struct stat &)info
+{
+    // Maps the .ipa rather than reading it, so hashing it doesn't need a copy in memory.
+    NSData *ipaData = [NSData dataWithContentsOfURL:ipaURL options:NSDataReadingMappedAlways error:nil];
+    if (ipaData == nil)
+    {
+        return NO;
+    }
+
+    ALTApplication *application = [[ALTApplication alloc] initWithIPAURL:ipaURL];
+    if (application == nil || application.bundleIdentifier == nil || application.version == nil)
+    {
+        return NO;
+    }
+
+    ALTCatalogRecord &record = item->record;
+    memset(&record, 0, sizeof(record));
+
+    item->path = ipaURL.path.fileSystemRepresentation;
+    item->bundleIdentifier = application.bundleIdentifier.UTF8String;
+    item->version = application.version.UTF8String;
+
+    for (ALTEntitlement entitlement in application.entitlements)
+    {
+        item->entitlements.push_back(entitlement.UTF8String);
+    }
+
+    ALTProvisioningProfile *profile = application.provisioningProfile;
+    if (profile != nil)
+    {
+        item->teamIdentifier = profile.teamIdentifier.UTF8String;
+
+        record.flags |= ALTCatalogRecordFlagHasProfile;
+        record.profileExpirationDate = (int64_t)profile.expirationDate.timeIntervalSince1970;
+        [profile.UUID getUUIDBytes:record.profileUUID];
+    }
+
+    record.fileSize = info.st_size;
+    record.modificationTime = ALTCatalogModificationTime(info);
+
+    record.minimumOSVersion[0] = (uint16_t)application.minimumiOSVersion.majorVersion;
+    record.minimumOSVersion[1] = (uint16_t)application.minimumiOSVersion.minorVersion;
+    record.minimumOSVersion[2] = (uint16_t)application.minimumiOSVersion.patchVersion;
+    record.supportedDeviceTypes = (uint16_t)application.supportedDeviceTypes;
+
+    SHA256((const unsigned char *)ipaData.bytes, ipaData.length, record.contentHash);
+
+    return YES;
+}
+
+// Every record in the catalog with its strings resolved, keyed by path.
+- (std::map<std::string, ALTCatalogItem>)items
+{
+    std::map<std::string, ALTCatalogItem> items;
+
+    if (self.data == nil)
+    {
+        return items;
+    }
+
+    const ALTCatalogRecord *records = self.records;
+    for (uint32_t index = 0; index < self.header->recordCount; index++)
+    {
+        const ALTCatalogRecord &record = records[index];
+
+        ALTCatalogItem item;
+        item.path = [self stringWithID:record.path];
+        item.bundleIdentifier = [self stringWithID:record.bundleIdentifier];
+        item.version = [self stringWithID:record.version];
+        item.teamIdentifier = [self stringWithID:record.teamIdentifier];
+        item.record = record;
+
+        for (uint32_t entitlement = 0; entitlement < record.entitlementsCount; entitlement++)
+        {
+            item.entitlements.push_back([self stringWithID:self.entitlementIDs[record.entitlementsIndex + entitlement]]);
+        }
+
+        items[item.path] = std::move(item);
+    }
+
+    return items;
+}
+
+- (BOOL)writeItems:(const std::map<std::string, ALTCatalogItem> &)items error:(NSError **)error
+{
+    // Intern every string. std::set keeps them sorted, so each string's ID is simply its position.
+    std::set<std::string> strings;
+    for (auto &pair : items)
+    {
+        const ALTCatalogItem &item = pair.second;
+
+        strings.insert(item.path);
+        strings.insert(item.bundleIdentifier);
+        strings.insert(item.version);
+        strings.insert(item.teamIdentifier);
+        strings.insert(item.entitlements.begin(), item.entitlements.end());
+    }
+
+    std::map<std::string, uint32_t> stringIDs;
+    std::vector<uint64_t> stringOffsets;
+    std::string stringData;
+
+    for (auto &string : strings)
+    {
+        stringIDs[string] = (uint32_t)stringOffsets.size();
+        stringOffsets.push_back(stringData.size());
+
+        stringData += string;
+        stringData.push_back('\0');
+    }
+
+    // std::map is sorted by path, which keeps records sorted by path too.
+    std::vector<ALTCatalogRecord> records;
+    std::vector<uint32_t> entitlementIDs;
+
+    for (auto &pair : items)
+    {
+        const ALTCatalogItem &item = pair.second;
+
+        ALTCatalogRecord record = item.record;
+        record.path = stringIDs[item.path];
+        record.bundleIdentifier = stringIDs[item.bundleIdentifier];
+        record.version = stringIDs[item.version];
+        record.teamIdentifier = stringIDs[item.teamIdentifier];
+
+        std::vector<uint32_t> entitlements;
+        for (auto &entitlement : item.entitlements)
+        {
+            entitlements.push_back(stringIDs[entitlement]);
+        }
+
+        std::sort(entitlements.begin(), entitlements.end());
+
+        record.entitlementsIndex = (uint32_t)entitlementIDs.size();
+        record.entitlementsCount = (uint32_t)entitlements.size();
+        entitlementIDs.insert(entitlementIDs.end(), entitlements.begin(), entitlements.end());
+
+        records.push_back(record);
+    }
+
+    ALTCatalogHeader header;
+    memcpy(header.magic, ALTCatalogMagic, sizeof(ALTCatalogMagic));
+    header.recordCount = (uint32_t)records.size();
+    header.entitlementCount = (uint32_t)entitlementIDs.size();
+    header.stringCount = (uint32_t)stringOffsets.size();
+    header.reserved = 0;
+    header.stringDataSize = stringData.size();
+
+    NSMutableData *data = [NSMutableData data];
+    [data appendBytes:&header length:sizeof(header)];
+    [data appendBytes:records.data() length:records.size() * sizeof(ALTCatalogRecord)];
+    [data appendBytes:entitlementIDs.data() length:entitlementIDs.size() * sizeof(uint32_t)];
+    [data increaseLengthBy:ALTCatalogEntitlementTableSize(header.entitlementCount) - entitlementIDs.size() * sizeof(uint32_t)];
+    [data appendBytes:stringOffsets.data() length:stringOffsets.size() * sizeof(uint64_t)];
+    [data appendBytes:stringData.data() length:stringData.size()];
+
+    // Written atomically, so anyone with the previous version mapped keeps reading it unchanged.
+    if (![data writeToURL:self.fileURL options:NSDataWritingAtomic error:error])
+    {
+        return NO;
+    }
+
+    NSData *mappedData = [NSData dataWithContentsOfURL:self.fileURL options:NSDataReadingMappedAlways error:error];
+    if (mappedData == nil)
+    {
+        return NO;
+    }
+
+    self.data = mappedData;
+    return YES;
+}
+
+@end
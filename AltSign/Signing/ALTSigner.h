@@ -24,6 +24,10 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (NSProgress *)signAppAtURL:(NSURL *)appURL provisioningProfiles:(NSArray<ALTProvisioningProfile *> *)profiles completionHandler:(void (^)(BOOL success, NSError *_Nullable error))completionHandler;
 
+- (NSProgress *)signAppsAtURLs:(NSArray<NSURL *> *)appURLs provisioningProfiles:(NSArray<ALTProvisioningProfile *> *)profiles
+          appCompletionHandler:(void (^)(NSURL *appURL, BOOL success, NSError *_Nullable error))appCompletionHandler
+             completionHandler:(void (^)(void))completionHandler;
+
 @end
 
 NS_ASSUME_NONNULL_END
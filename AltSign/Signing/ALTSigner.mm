@@ -16,65 +16,140 @@
 #import "NSFileManager+Apps.h"
 #import "NSError+ALTErrors.h"
 
-#include "ldid.hpp"
+#include "alt_ldid.hpp"
 
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 
 #include <openssl/pkcs12.h>
 #include <openssl/pem.h>
 
-std::string CertificatesContent(ALTCertificate *altCertificate)
+// Private key, leaf certificate, and Apple certificate chain parsed from an ALTCertificate,
+// along with the .p12 ldid signs with. Never modified after creation, so concurrent signing jobs can share one.
+class SigningIdentity
 {
-    NSURL *pemURL = [[NSBundle bundleForClass:ALTSigner.class] URLForResource:@"apple" withExtension:@"pem"];
+public:
+    SigningIdentity(ALTCertificate *altCertificate);
+    ~SigningIdentity();
     
-    NSData *altCertificateP12Data = [altCertificate p12Data];
+    SigningIdentity(const SigningIdentity &) = delete;
+    SigningIdentity &operator=(const SigningIdentity &) = delete;
     
-    BIO *inputP12Buffer = BIO_new(BIO_s_mem());
-    BIO_write(inputP12Buffer, altCertificateP12Data.bytes, (int)altCertificateP12Data.length);
+    EVP_PKEY *Key() const { return key_; }
+    X509 *Certificate() const { return certificate_; }
+    STACK_OF(X509) *Chain() const { return chain_; }
     
-    auto inputP12 = d2i_PKCS12_bio(inputP12Buffer, NULL);
+    const std::string &P12() const { return p12_; }
     
-    // Extract key + certificate from .p12.
-    EVP_PKEY *key;
-    X509 *certificate;
-    PKCS12_parse(inputP12, "", &key, &certificate, NULL);
+private:
+    EVP_PKEY *key_;
+    X509 *certificate_;
+    STACK_OF(X509) *chain_;
     
-    // Open .pem from file.
-    auto pemFile = fopen(pemURL.path.fileSystemRepresentation, "r");
+    std::string p12_;
+};
+
+static STACK_OF(X509) *AppleCertificateChain()
+{
+    static STACK_OF(X509) *certificates = NULL;
     
-    // Extract certificates from .pem.
-    auto *certificates = sk_X509_new(NULL);
-    while (auto certificate = PEM_read_X509(pemFile, NULL, NULL, NULL))
-    {
-        sk_X509_push(certificates, certificate);
-    }
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSURL *pemURL = [[NSBundle bundleForClass:ALTSigner.class] URLForResource:@"apple" withExtension:@"pem"];
+        
+        // Open .pem from file.
+        auto pemFile = fopen(pemURL.path.fileSystemRepresentation, "r");
+        
+        // Extract certificates from .pem.
+        certificates = sk_X509_new(NULL);
+        while (auto certificate = PEM_read_X509(pemFile, NULL, NULL, NULL))
+        {
+            sk_X509_push(certificates, certificate);
+        }
+        
+        fclose(pemFile);
+    });
+    
+    return certificates;
+}
+
+SigningIdentity::SigningIdentity(ALTCertificate *altCertificate) : key_(NULL), certificate_(NULL), chain_(X509_chain_up_ref(AppleCertificateChain()))
+{
+    // Read key + certificate straight from their PEM representations rather than round-tripping through -p12Data.
+    BIO *certificateBuffer = BIO_new_mem_buf(altCertificate.data.bytes, (int)altCertificate.data.length);
+    BIO *privateKeyBuffer = BIO_new_mem_buf(altCertificate.privateKey.bytes, (int)altCertificate.privateKey.length);
+    
+    PEM_read_bio_X509(certificateBuffer, &certificate_, NULL, NULL);
+    PEM_read_bio_PrivateKey(privateKeyBuffer, &key_, NULL, NULL);
+    
+    BIO_free(certificateBuffer);
+    BIO_free(privateKeyBuffer);
     
     // Create new .p12 in memory with private key and certificate chain.
+    // It never leaves this process and its password is empty anyway, so skip encryption and use a single MAC iteration;
+    // otherwise ldid spends most of its time re-deriving keys when it parses it for every app.
     char emptyString[] = "";
-    auto outputP12 = PKCS12_create(emptyString, emptyString, key, certificate, certificates, 0, 0, 0, 0, 0);
+    auto outputP12 = PKCS12_create(emptyString, emptyString, key_, certificate_, chain_, -1, -1, 1, 1, 0);
     
     BIO *outputP12Buffer = BIO_new(BIO_s_mem());
     i2d_PKCS12_bio(outputP12Buffer, outputP12);
     
     char *buffer = NULL;
-    NSUInteger size = BIO_get_mem_data(outputP12Buffer, &buffer);
+    long size = BIO_get_mem_data(outputP12Buffer, &buffer);
+    p12_.assign(buffer, size);
     
-    NSData *p12Data = [NSData dataWithBytes:buffer length:size];
-    
-    // Free .p12 structures
-    PKCS12_free(inputP12);
     PKCS12_free(outputP12);
-    
-    BIO_free(inputP12Buffer);
     BIO_free(outputP12Buffer);
+}
+
+SigningIdentity::~SigningIdentity()
+{
+    EVP_PKEY_free(key_);
+    X509_free(certificate_);
+    sk_X509_pop_free(chain_, X509_free);
+}
+
+// Signing identities are built once per certificate and reused by every signing job that follows, on any thread.
+std::shared_ptr<const SigningIdentity> SigningIdentityForCertificate(ALTCertificate *altCertificate)
+{
+    static std::mutex mutex;
+    static std::map<std::string, std::shared_ptr<const SigningIdentity>> identities;
     
-    // Close files
-    fclose(pemFile);
+    // Key by contents rather than serial number, since the same certificate may be paired with a different private key.
+    std::string key((const char *)altCertificate.data.bytes, altCertificate.data.length);
+    key.push_back('\0');
+    key.append((const char *)altCertificate.privateKey.bytes, altCertificate.privateKey.length);
     
-    std::string output((const char *)p12Data.bytes, (size_t)p12Data.length);
-    return output;
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    auto &identity = identities[key];
+    if (identity == nullptr)
+    {
+        identity = std::make_shared<const SigningIdentity>(altCertificate);
+    }
+    
+    return identity;
 }
 
+// State handed from one stage of signing an .ipa in place to the next.
+struct IPASigningJob
+{
+    IPASigningJob(NSURL *ipaURL, ALTApplication *application, NSProgress *progress) : ipaURL(ipaURL), application(application), progress(progress)
+    {
+    }
+    
+    NSURL *ipaURL;
+    ALTApplication *application;
+    NSProgress *progress;
+    
+    NSURL *rootURL;
+    NSMutableDictionary<NSURL *, NSString *> *entitlementsByFileURL;
+    
+    std::unique_ptr<ldid::ArchiveFolder> appBundle;
+};
+
 @implementation ALTSigner
 
 + (void)load
@@ -120,6 +195,14 @@ std::string CertificatesContent(ALTCertificate *altCertificate)
     {
         ipaURL = appURL;
         
+        ALTApplication *application = [[ALTApplication alloc] initWithIPAURL:ipaURL];
+        if (application != nil)
+        {
+            [self signApplication:application inIPAAtURL:ipaURL provisioningProfiles:profiles progress:progress completionHandler:finish];
+            return progress;
+        }
+        
+        // Fall back to extracting the app bundle if it can't be read from the .ipa directly.
         NSURL *outputDirectoryURL = [[appURL URLByDeletingLastPathComponent] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString] isDirectory:YES];
         if (![[NSFileManager defaultManager] createDirectoryAtURL:outputDirectoryURL withIntermediateDirectories:YES attributes:nil error:&error])
         {
@@ -153,29 +236,31 @@ std::string CertificatesContent(ALTCertificate *altCertificate)
         return progress;
     }
     
-    NSDirectoryEnumerator *countEnumerator = [[NSFileManager defaultManager] enumeratorAtURL:appURL
-                                                                  includingPropertiesForKeys:@[NSURLIsDirectoryKey]
-                                                                                     options:0
-                                                                                errorHandler:^BOOL(NSURL * _Nonnull url, NSError * _Nonnull error) {
-                                                                                    if (error) {
-                                                                                        NSLog(@"[Error] %@ (%@)", error, url);
-                                                                                        return NO;
-                                                                                    }
-                                                                                    
-                                                                                    return YES;
-                                                                                }];
+    // Walk the bundle once up front; counting files for progress and finding app extensions both read from the manifest.
+    std::shared_ptr<ldid::BundleManifest> manifest;
+    
+    try
+    {
+        manifest = std::make_shared<ldid::BundleManifest>(ldid::ScanBundle(appBundleURL.fileSystemRepresentation, NSProcessInfo.processInfo.activeProcessorCount));
+    }
+    catch (...)
+    {
+        NSLog(@"[Error] Failed to scan app bundle at %@", appBundleURL);
         
+        finish(NO, [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorInvalidApp userInfo:nil]);
+        return progress;
+    }
+    
     NSInteger totalCount = 0;
-    for (NSURL *__unused fileURL in countEnumerator)
+    for (auto &file : manifest->files)
     {
-        NSNumber *isDirectory = nil;
-        if (![fileURL getResourceValue:&isDirectory forKey:NSURLIsDirectoryKey error:nil] || [isDirectory boolValue])
+        if (S_ISDIR(file.mode))
         {
             continue;
         }
         
         // Ignore CodeResources files.
-        if ([[fileURL lastPathComponent] isEqualToString:@"CodeResources"])
+        if ([@(file.path.c_str()).lastPathComponent isEqualToString:@"CodeResources"])
         {
             continue;
         }
@@ -211,36 +296,14 @@ std::string CertificatesContent(ALTCertificate *altCertificate)
             
             NSURL *profileURL = [app.fileURL URLByAppendingPathComponent:@"embedded.mobileprovision"];
             [profile.data writeToURL:profileURL atomically:YES];
+            [ALTApplication invalidateCachedApplicationAtURL:app.fileURL];
             
-            NSString *additionalEntitlements = nil;
-            
-            NSRange commentStartRange = [app.entitlementsString rangeOfString:@"<!---><!-->"];
-            NSRange commentEndRange = [app.entitlementsString rangeOfString:@"<!-- -->"];
-            if (commentStartRange.location != NSNotFound && commentEndRange.location != NSNotFound && commentEndRange.location > commentStartRange.location)
-            {
-                // Most likely using private (commented out) entitlements to exploit Psychic Paper https://github.com/Siguza/psychicpaper
-                // Assume they know what they are doing and extract private entitlements to merge with profile's.
-                
-                NSRange commentRange = NSMakeRange(commentStartRange.location, (commentEndRange.location + commentEndRange.length) - commentStartRange.location);
-                NSString *commentedEntitlements = [app.entitlementsString substringWithRange:commentRange];
-                
-                additionalEntitlements = commentedEntitlements;
-            }
-            
-            NSData *entitlementsData = [NSPropertyListSerialization dataWithPropertyList:profile.entitlements format:NSPropertyListXMLFormat_v1_0 options:0 error:&error];
-            if (entitlementsData == nil)
+            NSString *entitlements = [self entitlementsForApplication:app profile:profile error:&error];
+            if (entitlements == nil)
             {
                 return error;
             }
             
-            NSMutableString *entitlements = [[NSMutableString alloc] initWithData:entitlementsData encoding:NSUTF8StringEncoding];
-            if (additionalEntitlements != nil)
-            {
-                // Insert additional entitlements after first occurence of <dict>.
-                NSRange entitlementsStartRange = [entitlements rangeOfString:@"<dict>"];
-                [entitlements insertString:additionalEntitlements atIndex:entitlementsStartRange.location + entitlementsStartRange.length];
-            }
-            
             entitlementsByFileURL[app.fileURL] = entitlements;
             
             return nil;
@@ -253,13 +316,29 @@ std::string CertificatesContent(ALTCertificate *altCertificate)
             return;
         }
         
-        NSURL *pluginsURL = [appBundle builtInPlugInsURL];
+        // App extensions are the direct children of PlugIns/.
+        static const std::string plugInsPath("PlugIns/");
         
-        NSDirectoryEnumerator *enumerator = [[NSFileManager defaultManager] enumeratorAtURL:pluginsURL
-                                                                 includingPropertiesForKeys:nil options:NSDirectoryEnumerationSkipsSubdirectoryDescendants errorHandler:nil];
-        
-        for (NSURL *extensionURL in enumerator)
+        for (auto &file : manifest->files)
         {
+            if (file.path.compare(0, plugInsPath.size(), plugInsPath) != 0)
+            {
+                continue;
+            }
+            
+            std::string name = file.path.substr(plugInsPath.size());
+            if (!name.empty() && name.back() == '/')
+            {
+                name.pop_back();
+            }
+            
+            if (name.empty() || name.find('/') != std::string::npos)
+            {
+                continue;
+            }
+            
+            NSURL *extensionURL = [appBundleURL URLByAppendingPathComponent:@(file.path.c_str())];
+            
             ALTApplication *appExtension = [[ALTApplication alloc] initWithFileURL:extensionURL];
             if (appExtension == nil)
             {
@@ -283,24 +362,292 @@ std::string CertificatesContent(ALTCertificate *altCertificate)
         
         
         // Sign application
-        ldid::DiskFolder appBundle(application.fileURL.fileSystemRepresentation);
-        std::string key = CertificatesContent(self.certificate);
+        {
+            // ldid::DiskFolder writes signed files to temporary copies and only moves them into place when it is destroyed,
+            // so once this scope exits every file has been written, closed, and committed, and repacking can start right away.
+            ldid::DiskFolder appBundle(application.fileURL.fileSystemRepresentation);
+            auto identity = SigningIdentityForCertificate(self.certificate);
+            
+            ldid::Sign("", appBundle, identity->P12(), "",
+                       ldid::fun([&](const std::string &path, const std::string &binaryEntitlements) -> std::string {
+                NSString *filename = [NSString stringWithCString:path.c_str() encoding:NSUTF8StringEncoding];
+                
+                NSURL *fileURL = nil;
+                
+                if (filename.length == 0)
+                {
+                    fileURL = application.fileURL;
+                }
+                else
+                {
+                    fileURL = [application.fileURL URLByAppendingPathComponent:filename isDirectory:YES];
+                }
+                
+                NSString *entitlements = entitlementsByFileURL[fileURL];
+                return entitlements.UTF8String;
+            }),
+                       ldid::fun([&](const std::string &string) {
+                progress.completedUnitCount += 1;
+            }),
+                       ldid::fun([&](const double signingProgress) {
+            }));
+        }
         
-        ldid::Sign("", appBundle, key, "",
-                   ldid::fun([&](const std::string &path, const std::string &binaryEntitlements) -> std::string {
-            NSString *filename = [NSString stringWithCString:path.c_str() encoding:NSUTF8StringEncoding];
+        if (ipaURL != nil)
+        {
+            NSURL *resignedIPAURL = [[NSFileManager defaultManager] zipAppBundleAtURL:appBundleURL reusingEntriesFromIPAAtURL:ipaURL error:&error];
+            if (resignedIPAURL == nil)
+            {
+                finish(NO, error);
+                return;
+            }
+            
+            if (![[NSFileManager defaultManager] replaceItemAtURL:ipaURL withItemAtURL:resignedIPAURL backupItemName:nil options:0 resultingItemURL:nil error:&error])
+            {
+                finish(NO, error);
+                return;
+            }
+        }
+        
+        finish(YES, nil);
+    });
+
+    return progress;
+}
+
+- (NSProgress *)signAppsAtURLs:(NSArray<NSURL *> *)appURLs provisioningProfiles:(NSArray<ALTProvisioningProfile *> *)profiles
+          appCompletionHandler:(void (^)(NSURL *appURL, BOOL success, NSError *error))appCompletionHandler
+             completionHandler:(void (^)(void))completionHandler
+{
+    NSProgress *progress = [NSProgress discreteProgressWithTotalUnitCount:appURLs.count];
+    
+    // Each .ipa moves through three stages, each on its own serial queue: preparing (which starts inflating its files), signing, and repacking.
+    // That way one app is read while the previous one is signed and the one before that is compressed.
+    dispatch_queue_t prepareQueue = dispatch_queue_create("com.rileytestut.AltSign.BatchSigning.Prepare", DISPATCH_QUEUE_SERIAL);
+    dispatch_queue_t signQueue = dispatch_queue_create("com.rileytestut.AltSign.BatchSigning.Sign", DISPATCH_QUEUE_SERIAL);
+    dispatch_queue_t repackQueue = dispatch_queue_create("com.rileytestut.AltSign.BatchSigning.Repack", DISPATCH_QUEUE_SERIAL);
+    
+    // A stage only hands an app to the next one once that stage is free, so a slow stage holds back the ones before it
+    // instead of letting prepared (and partially inflated) apps pile up in memory.
+    dispatch_semaphore_t signSemaphore = dispatch_semaphore_create(1);
+    dispatch_semaphore_t repackSemaphore = dispatch_semaphore_create(1);
+    
+    dispatch_group_t group = dispatch_group_create();
+    
+    // Every app in the batch is signed with the same identity.
+    auto identity = SigningIdentityForCertificate(self.certificate);
+    
+    for (NSURL *appURL in appURLs)
+    {
+        NSProgress *appProgress = [NSProgress discreteProgressWithTotalUnitCount:1];
+        [progress addChild:appProgress withPendingUnitCount:1];
+        
+        void (^finish)(BOOL, NSError *) = ^(BOOL success, NSError *error) {
+            appProgress.completedUnitCount = appProgress.totalUnitCount;
+            
+            appCompletionHandler(appURL, success, error);
+            dispatch_group_leave(group);
+        };
+        
+        dispatch_group_enter(group);
+        dispatch_async(prepareQueue, ^{
+            ALTApplication *application = nil;
+            if ([appURL.pathExtension.lowercaseString isEqualToString:@"ipa"])
+            {
+                application = [[ALTApplication alloc] initWithIPAURL:appURL];
+            }
             
-            NSURL *fileURL = nil;
+            if (application == nil)
+            {
+                // Can't be signed in place, so sign it on its own outside the pipeline.
+                [self signAppAtURL:appURL provisioningProfiles:profiles completionHandler:finish];
+                return;
+            }
             
-            if (filename.length == 0)
+            auto job = std::make_shared<IPASigningJob>(appURL, application, appProgress);
+            
+            NSError *error = nil;
+            if (![self prepareIPASigningJob:job provisioningProfiles:profiles error:&error])
             {
-                fileURL = application.fileURL;
+                finish(NO, error);
+                return;
             }
-            else
+            
+            dispatch_semaphore_wait(signSemaphore, DISPATCH_TIME_FOREVER);
+            dispatch_async(signQueue, ^{
+                NSError *error = nil;
+                BOOL success = [self signIPASigningJob:job identity:*identity error:&error];
+                dispatch_semaphore_signal(signSemaphore);
+                
+                if (!success)
+                {
+                    job->appBundle.reset();
+                    
+                    finish(NO, error);
+                    return;
+                }
+                
+                dispatch_semaphore_wait(repackSemaphore, DISPATCH_TIME_FOREVER);
+                dispatch_async(repackQueue, ^{
+                    NSError *error = nil;
+                    BOOL success = [self finishIPASigningJob:job error:&error];
+                    
+                    // Release the archive and its signed files before the next app starts repacking.
+                    job->appBundle.reset();
+                    dispatch_semaphore_signal(repackSemaphore);
+                    
+                    finish(success, error);
+                });
+            });
+        });
+    }
+    
+    dispatch_group_notify(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        completionHandler();
+    });
+    
+    return progress;
+}
+
+- (void)signApplication:(ALTApplication *)application inIPAAtURL:(NSURL *)ipaURL provisioningProfiles:(NSArray<ALTProvisioningProfile *> *)profiles
+               progress:(NSProgress *)progress completionHandler:(void (^)(BOOL success, NSError *error))completionHandler
+{
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        auto job = std::make_shared<IPASigningJob>(ipaURL, application, progress);
+        
+        NSError *error = nil;
+        if (![self prepareIPASigningJob:job provisioningProfiles:profiles error:&error])
+        {
+            completionHandler(NO, error);
+            return;
+        }
+        
+        if (![self signIPASigningJob:job identity:*SigningIdentityForCertificate(self.certificate) error:&error])
+        {
+            completionHandler(NO, error);
+            return;
+        }
+        
+        if (![self finishIPASigningJob:job error:&error])
+        {
+            completionHandler(NO, error);
+            return;
+        }
+        
+        completionHandler(YES, nil);
+    });
+}
+
+- (BOOL)prepareIPASigningJob:(std::shared_ptr<IPASigningJob>)job provisioningProfiles:(NSArray<ALTProvisioningProfile *> *)profiles error:(NSError **)error
+{
+    try
+    {
+        ALTApplication *application = job->application;
+        
+        // Sign directly against the .ipa: files are read from the archive as needed, and only what ldid writes
+        // is compressed into the new .ipa. Everything else is copied over without being extracted or recompressed.
+        job->appBundle.reset(new ldid::ArchiveFolder(job->ipaURL.fileSystemRepresentation, application.archiveBundlePath.fileSystemRepresentation));
+        ldid::ArchiveFolder &appBundle = *job->appBundle;
+        
+        NSInteger totalCount = 0;
+        appBundle.Find("", ldid::fun([&](const std::string &path) {
+            // Ignore CodeResources files.
+            if ([@(path.c_str()).lastPathComponent isEqualToString:@"CodeResources"])
+            {
+                return;
+            }
+            
+            totalCount++;
+        }), ldid::fun([&](const std::string &path, const ldid::Functor<std::string ()> &read) {
+            totalCount++;
+        }));
+        
+        job->progress.totalUnitCount = totalCount;
+        
+        job->rootURL = [job->ipaURL URLByAppendingPathComponent:application.archiveBundlePath isDirectory:YES];
+        job->entitlementsByFileURL = [NSMutableDictionary dictionary];
+        
+        NSMutableArray<ALTApplication *> *applications = [NSMutableArray arrayWithObject:application];
+        [applications addObjectsFromArray:application.appExtensions.allObjects];
+        
+        for (ALTApplication *app in applications)
+        {
+            ALTProvisioningProfile *profile = nil;
+            for (ALTProvisioningProfile *candidate in profiles)
             {
-                fileURL = [application.fileURL URLByAppendingPathComponent:filename isDirectory:YES];
+                if ([candidate.bundleIdentifier isEqualToString:app.bundleIdentifier])
+                {
+                    profile = candidate;
+                    break;
+                }
             }
             
+            if (profile == nil)
+            {
+                if (error)
+                {
+                    *error = [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorMissingProvisioningProfile userInfo:nil];
+                }
+                
+                return NO;
+            }
+            
+            NSString *entitlements = [self entitlementsForApplication:app profile:profile error:error];
+            if (entitlements == nil)
+            {
+                return NO;
+            }
+            
+            // Paths given to ldid::ArchiveFolder are relative to the main app bundle, e.g. "PlugIns/Widget.appex/".
+            NSString *relativePath = @"";
+            if (app != application)
+            {
+                relativePath = [[app.archiveBundlePath substringFromIndex:application.archiveBundlePath.length + 1] stringByAppendingString:@"/"];
+            }
+            
+            std::string profilePath = [relativePath stringByAppendingString:@"embedded.mobileprovision"].UTF8String;
+            appBundle.Save(profilePath, true, NULL, ldid::fun([&](std::streambuf &save) {
+                save.sputn((const char *)profile.data.bytes, profile.data.length);
+            }));
+            
+            job->entitlementsByFileURL[[job->rootURL URLByAppendingPathComponent:relativePath isDirectory:YES]] = entitlements;
+        }
+        
+        // ldid signs on one thread alone, so keep the other cores busy inflating files ahead of it.
+        appBundle.Prefetch(NSProcessInfo.processInfo.activeProcessorCount);
+        
+        return YES;
+    }
+    catch (...)
+    {
+        NSLog(@"[Error] Failed to read app bundle from %@", job->ipaURL);
+        
+        job->appBundle.reset();
+        
+        if (error)
+        {
+            *error = [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorInvalidApp userInfo:nil];
+        }
+        
+        return NO;
+    }
+}
+
+- (BOOL)signIPASigningJob:(std::shared_ptr<IPASigningJob>)job identity:(const SigningIdentity &)identity error:(NSError **)error
+{
+    try
+    {
+        NSURL *rootURL = job->rootURL;
+        NSDictionary<NSURL *, NSString *> *entitlementsByFileURL = job->entitlementsByFileURL;
+        NSProgress *progress = job->progress;
+        
+        // Sign application
+        ldid::Sign("", *job->appBundle, identity.P12(), "",
+                   ldid::fun([&](const std::string &path, const std::string &binaryEntitlements) -> std::string {
+            NSString *filename = [NSString stringWithCString:path.c_str() encoding:NSUTF8StringEncoding];
+            
+            NSURL *fileURL = [rootURL URLByAppendingPathComponent:filename isDirectory:YES];
+            
             NSString *entitlements = entitlementsByFileURL[fileURL];
             return entitlements.UTF8String;
         }),
@@ -310,24 +657,124 @@ std::string CertificatesContent(ALTCertificate *altCertificate)
                    ldid::fun([&](const double signingProgress) {
         }));
         
+        return YES;
+    }
+    catch (...)
+    {
+        NSLog(@"[Error] Failed to sign app in %@", job->ipaURL);
+        
+        if (error)
+        {
+            *error = [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorInvalidApp userInfo:nil];
+        }
+        
+        return NO;
+    }
+}
+
+- (BOOL)finishIPASigningJob:(std::shared_ptr<IPASigningJob>)job error:(NSError **)error
+{
+    try
+    {
+        NSURL *ipaURL = job->ipaURL;
+        
+        // ldid::Sign has returned, so every signed file is already in appBundle; nothing is left to wait on before repacking.
+        NSError *changesError = nil;
+        NSMutableDictionary<NSString *, NSData *> *signedItems = [NSMutableDictionary dictionary];
         
-        // Dispatch after to allow time to finish signing binary.
-        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-            if (ipaURL != nil)
+        job->appBundle->Changes(ldid::fun([&](const std::string &path, const std::string &data, const std::string &spillPath) {
+            NSString *filename = [NSString stringWithCString:path.c_str() encoding:NSUTF8StringEncoding];
+            
+            if (spillPath.empty())
             {
-                NSURL *resignedIPAURL = [[NSFileManager defaultManager] zipAppBundleAtURL:appBundleURL error:&error];
-                
-                if (![[NSFileManager defaultManager] replaceItemAtURL:ipaURL withItemAtURL:resignedIPAURL backupItemName:nil options:0 resultingItemURL:nil error:&error])
+                // appBundle outlives signedItems, so there's no need to copy its contents.
+                signedItems[filename] = [NSData dataWithBytesNoCopy:(void *)data.data() length:data.size() freeWhenDone:NO];
+            }
+            else
+            {
+                NSError *mapError = nil;
+                NSData *mappedData = [NSData dataWithContentsOfFile:@(spillPath.c_str()) options:NSDataReadingMappedAlways error:&mapError];
+                if (mappedData == nil)
                 {
-                    finish(NO, error);
+                    changesError = mapError;
+                    return;
                 }
+                
+                signedItems[filename] = mappedData;
+            }
+        }));
+        
+        if (changesError != nil)
+        {
+            if (error)
+            {
+                *error = changesError;
             }
             
-            finish(YES, nil);
-        });
-    });
+            return NO;
+        }
+        
+        NSString *resignedIPAName = [NSString stringWithFormat:@"%@.ipa", [[NSUUID UUID] UUIDString]];
+        NSURL *resignedIPAURL = [[ipaURL URLByDeletingLastPathComponent] URLByAppendingPathComponent:resignedIPAName];
+        
+        if (![[NSFileManager defaultManager] writeIPAAtURL:resignedIPAURL fromIPAAtURL:ipaURL replacingItems:signedItems error:error])
+        {
+            return NO;
+        }
+        
+        if (![[NSFileManager defaultManager] replaceItemAtURL:ipaURL withItemAtURL:resignedIPAURL backupItemName:nil options:0 resultingItemURL:nil error:error])
+        {
+            [[NSFileManager defaultManager] removeItemAtURL:resignedIPAURL error:nil];
+            return NO;
+        }
+        
+        return YES;
+    }
+    catch (...)
+    {
+        NSLog(@"[Error] Failed to repack %@", job->ipaURL);
+        
+        if (error)
+        {
+            *error = [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorUnknown userInfo:nil];
+        }
+        
+        return NO;
+    }
+}
 
-    return progress;
+- (nullable NSString *)entitlementsForApplication:(ALTApplication *)app profile:(ALTProvisioningProfile *)profile error:(NSError **)error
+{
+    NSString *additionalEntitlements = nil;
+    
+    NSRange commentStartRange = [app.entitlementsString rangeOfString:@"<!---><!-->"];
+    NSRange commentEndRange = [app.entitlementsString rangeOfString:@"<!-- -->"];
+    if (commentStartRange.location != NSNotFound && commentEndRange.location != NSNotFound && commentEndRange.location > commentStartRange.location)
+    {
+        // Most likely using private (commented out) entitlements to exploit Psychic Paper https://github.com/Siguza/psychicpaper
+        // Assume they know what they are doing and extract private entitlements to merge with profile's.
+        
+        NSRange commentRange = NSMakeRange(commentStartRange.location, (commentEndRange.location + commentEndRange.length) - commentStartRange.location);
+        NSString *commentedEntitlements = [app.entitlementsString substringWithRange:commentRange];
+        
+        additionalEntitlements = commentedEntitlements;
+    }
+    
+    NSData *entitlementsData = [NSPropertyListSerialization dataWithPropertyList:profile.entitlements format:NSPropertyListXMLFormat_v1_0 options:0 error:error];
+    if (entitlementsData == nil)
+    {
+        return nil;
+    }
+    
+    NSMutableString *entitlements = [[NSMutableString alloc] initWithData:entitlementsData encoding:NSUTF8StringEncoding];
+    if (additionalEntitlements != nil)
+    {
+        // Insert additional entitlements after first occurence of <dict>.
+        NSRange entitlementsStartRange = [entitlements rangeOfString:@"<dict>"];
+        [entitlements insertString:additionalEntitlements atIndex:entitlementsStartRange.location + entitlementsStartRange.length];
+    }
+    
+    return entitlements;
 }
 
 @end
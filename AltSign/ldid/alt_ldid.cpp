@@ -16,6 +16,15 @@
 // Undefine our hacky main redefinition.
 #undef main
 
+#include "alt_ldid.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <dirent.h>
+#include <regex>
+#include <set>
+#include <thread>
+
 namespace ldid
 {
     // Based heavily on ldid::Sign executable locating logic.
@@ -50,70 +59,889 @@ namespace ldid
     // Based heavily on ldid's -e argument logic.
     std::string Entitlements(std::string path)
     {
+        std::string entitlements;
+        
+        ReadEntitlements(path, fun([&](const char *bytes, size_t length) {
+            entitlements.assign(bytes, length);
+        }));
+        
+        return entitlements;
+    }
+    
+    std::string Entitlements(const void *data, size_t size)
+    {
+        auto entitlements = EntitlementsRange(data, size);
+        return std::string(entitlements.first, entitlements.second);
+    }
+    
+    void ReadEntitlements(std::string path, const Functor<void (const char *, size_t)> &code)
+    {
+        MachOIndex index(path);
+        
+        auto entitlements = index.Entitlements();
+        code(entitlements.first, entitlements.second);
+    }
+    
+    std::pair<const char *, size_t> EntitlementsRange(const void *data, size_t size)
+    {
+        return MachOIndex(data, size).Entitlements();
+    }
+    
+    class MachOIndex::Mapping
+    {
+    public:
+        Mapping(const std::string &path) : map_(path, false)
+        {
+        }
+        
+        Map map_;
+    };
+    
+    MachOIndex::MachOIndex(const void *data, size_t size) : entitlements_((const char *)NULL, 0)
+    {
+        Parse(reinterpret_cast<const uint8_t *>(data), size);
+    }
+    
+    MachOIndex::MachOIndex(const std::string &path) : entitlements_((const char *)NULL, 0)
+    {
+        std::string executablePath = path;
+        
         struct stat info;
-        _syscall(stat(path.c_str(), &info));
+        _syscall(stat(executablePath.c_str(), &info));
         
         if (S_ISDIR(info.st_mode))
         {
-            path += "/" + ExecutablePath(path);
+            executablePath += "/" + ExecutablePath(executablePath);
         }
         
-        std::stringstream stringstream;
+        mapping_.reset(new Mapping(executablePath));
         
-        Map mapping(path, false);
-        FatHeader fat_header(mapping.data(), mapping.size());
+        Parse(reinterpret_cast<const uint8_t *>(mapping_->map_.data()), mapping_->map_.size());
+    }
+    
+    MachOIndex::~MachOIndex()
+    {
+    }
+    
+    void MachOIndex::Parse(const uint8_t *data, size_t size)
+    {
+        FatHeader fat_header(const_cast<uint8_t *>(data), size);
         
         _foreach (mach_header, fat_header.GetMachHeaders())
         {
-            struct linkedit_data_command *signature(NULL);
+            size_t sliceOffset = reinterpret_cast<const uint8_t *>(mach_header.GetBase()) - data;
+            size_t sliceSize = mach_header.GetSize();
+            
+            size_t signatureOffset = 0;
+            size_t signatureSize = 0;
             
             _foreach (load_command, mach_header.GetLoadCommands())
             {
-                uint32_t cmd(mach_header.Swap(load_command->cmd));
-                if (cmd == LC_CODE_SIGNATURE)
+                if (mach_header.Swap(load_command->cmd) == LC_CODE_SIGNATURE)
+                {
+                    auto signature = reinterpret_cast<struct linkedit_data_command *>(load_command);
+                    signatureOffset = mach_header.Swap(signature->dataoff);
+                    signatureSize = mach_header.Swap(signature->datasize);
+                }
+            }
+            
+            _assert_(sliceOffset + sliceSize <= size, "slice extends past the end of the file");
+            _assert_(signatureOffset + signatureSize <= sliceSize, "code signature extends past the end of its slice");
+            
+            if (signatureSize < sizeof(struct SuperBlob))
+            {
+                continue;
+            }
+            
+            // SuperBlobs are always big-endian, regardless of the slice.
+            auto super = reinterpret_cast<const struct SuperBlob *>(data + sliceOffset + signatureOffset);
+            
+            // Binaries may come from anywhere, so only trust a slot table that fits inside the signature, and only read
+            // blobs that fit in it too. A signature that fails either check is treated as having no entitlements.
+            size_t count = Swap(super->count);
+            if (count > (signatureSize - sizeof(struct SuperBlob)) / sizeof(super->index[0]))
+            {
+                continue;
+            }
+            
+            for (size_t index(0); index != count; ++index)
+            {
+                uint32_t offset = Swap(super->index[index].offset);
+                if (Swap(super->index[index].type) != CSSLOT_ENTITLEMENTS || offset > signatureSize - sizeof(struct Blob))
+                {
+                    continue;
+                }
+                
+                auto entitlements = reinterpret_cast<const struct Blob *>(reinterpret_cast<const uint8_t *>(super) + offset);
+                size_t length = Swap(entitlements->length);
+                
+                if (length > sizeof(*entitlements) && length <= signatureSize - offset)
+                {
+                    // One valid mach_header is all we need to retrieve entitlements, so return to stop iterating over the next ones.
+                    entitlements_ = std::make_pair(reinterpret_cast<const char *>(entitlements + 1), length - sizeof(*entitlements));
+                    return;
+                }
+            }
+        }
+        
+        // No entitlements found in any mach_header, so entitlements_ stays empty.
+    }
+    
+    std::pair<const char *, size_t> MachOIndex::Entitlements() const
+    {
+        return entitlements_;
+    }
+    
+    BundleManifest ScanBundle(const std::string &root, size_t threads)
+    {
+        BundleManifest manifest;
+        
+        int rootDirectory;
+        _syscall(rootDirectory = open(root.c_str(), O_RDONLY | O_DIRECTORY));
+        
+        // Directories waiting to be read, relative to root. Workers push the subdirectories they find back onto it,
+        // and the walk is over once it's empty and no worker is still reading one.
+        std::deque<std::string> pending;
+        pending.push_back("");
+        
+        size_t reading = 0;
+        
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::exception_ptr error;
+        
+        auto read = [&](const std::string &directory, std::vector<BundleManifest::File> &files, std::vector<std::string> &subdirectories) {
+            int descriptor;
+            _syscall(descriptor = directory.empty() ? dup(rootDirectory) : openat(rootDirectory, directory.c_str(), O_RDONLY | O_DIRECTORY));
+            
+            DIR *handle = fdopendir(descriptor);
+            if (handle == NULL)
+            {
+                close(descriptor);
+                _assert_(false, "unable to read %s", directory.c_str());
+            }
+            
+            while (struct dirent *entry = readdir(handle))
+            {
+                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
                 {
-                    signature = reinterpret_cast<struct linkedit_data_command *>(load_command);
+                    continue;
                 }
+                
+                struct stat info;
+                if (fstatat(dirfd(handle), entry->d_name, &info, AT_SYMLINK_NOFOLLOW) == -1)
+                {
+                    closedir(handle);
+                    _assert_(false, "unable to stat %s%s", directory.c_str(), entry->d_name);
+                }
+                
+                BundleManifest::File file;
+                file.path = directory + entry->d_name;
+                file.mode = info.st_mode;
+                file.size = info.st_size;
+                
+                if (S_ISDIR(info.st_mode))
+                {
+                    file.path += "/";
+                    subdirectories.push_back(file.path);
+                }
+                
+                files.push_back(std::move(file));
             }
             
-            if (signature != NULL)
+            closedir(handle);
+        };
+        
+        auto scan = [&]() {
+            std::vector<BundleManifest::File> files;
+            std::vector<std::string> subdirectories;
+            
+            std::unique_lock<std::mutex> lock(mutex);
+            
+            while (true)
             {
-                uint32_t data = mach_header.Swap(signature->dataoff);
+                condition.wait(lock, [&]() { return !pending.empty() || reading == 0 || error; });
+                
+                if (pending.empty() || error)
+                {
+                    break;
+                }
                 
-                uint8_t *top = reinterpret_cast<uint8_t *>(mach_header.GetBase());
-                uint8_t *blob = top + data;
-                struct SuperBlob *super = reinterpret_cast<struct SuperBlob *>(blob);
+                std::string directory = std::move(pending.front());
+                pending.pop_front();
                 
-                for (size_t index(0); index != Swap(super->count); ++index)
+                reading++;
+                lock.unlock();
+                
+                try
+                {
+                    read(directory, files, subdirectories);
+                }
+                catch (...)
                 {
-                    if (Swap(super->index[index].type) == CSSLOT_ENTITLEMENTS)
+                    lock.lock();
+                    
+                    if (!error)
                     {
-                        uint32_t begin = Swap(super->index[index].offset);
-                        struct Blob *entitlements = reinterpret_cast<struct Blob *>(blob + begin);
-                        
-                        char *bytes = (char *)(entitlements + 1);
-                        int size = Swap(entitlements->length) - sizeof(*entitlements);
-                        
-                        for (int i = 0; i < size; i++)
-                        {
-                            char byte = bytes[i];
-                            stringstream << byte;
-                        }
-                        
-                        if (size > 0)
-                        {
-                            auto entitlementsString = stringstream.str();
-                            
-                            // One valid mach_header is all we need to retrieve entitlements, so return to stop iterating over the next ones.
-                            return entitlementsString;
-                        }
+                        error = std::current_exception();
                     }
+                    
+                    reading--;
+                    condition.notify_all();
+                    break;
+                }
+                
+                lock.lock();
+                reading--;
+                
+                pending.insert(pending.end(), std::make_move_iterator(subdirectories.begin()), std::make_move_iterator(subdirectories.end()));
+                subdirectories.clear();
+                
+                condition.notify_all();
+            }
+            
+            manifest.files.insert(manifest.files.end(), std::make_move_iterator(files.begin()), std::make_move_iterator(files.end()));
+        };
+        
+        threads = std::max<size_t>(1, threads);
+        
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < threads; i++)
+        {
+            workers.emplace_back(scan);
+        }
+        
+        scan();
+        
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+        
+        close(rootDirectory);
+        
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        
+        std::sort(manifest.files.begin(), manifest.files.end(), [](const BundleManifest::File &a, const BundleManifest::File &b) {
+            return a.path < b.path;
+        });
+        
+        return manifest;
+    }
+    
+    // Read-only, seekable view of bytes already in memory.
+    class MemoryBuffer : public std::streambuf
+    {
+    public:
+        MemoryBuffer(const std::string &data)
+        {
+            char *begin = const_cast<char *>(data.data());
+            setg(begin, begin, begin + data.size());
+        }
+        
+    protected:
+        virtual pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode mode)
+        {
+            char *base = direction == std::ios_base::beg ? eback() : (direction == std::ios_base::cur ? gptr() : egptr());
+            char *position = base + offset;
+            
+            if (position < eback() || position > egptr())
+            {
+                return pos_type(off_type(-1));
+            }
+            
+            setg(eback(), position, egptr());
+            return pos_type(position - eback());
+        }
+        
+        virtual pos_type seekpos(pos_type position, std::ios_base::openmode mode)
+        {
+            return seekoff(off_type(position), std::ios_base::beg, mode);
+        }
+    };
+    
+    // Collects output in memory, moving it to a temporary file once it grows past threshold.
+    class SpillBuffer : public std::streambuf
+    {
+    public:
+        SpillBuffer(std::string &data, std::string &spillPath, size_t threshold) : data_(data), spillPath_(spillPath), threshold_(threshold), file_(-1)
+        {
+        }
+        
+        ~SpillBuffer()
+        {
+            if (file_ != -1)
+            {
+                close(file_);
+            }
+        }
+        
+    protected:
+        virtual std::streamsize xsputn(const char *bytes, std::streamsize size)
+        {
+            if (file_ == -1 && data_.size() + size > threshold_)
+            {
+                const char *directory = getenv("TMPDIR");
+                std::string path = std::string(directory != NULL ? directory : "/tmp") + "/ldid.XXXXXX";
+                
+                _syscall(file_ = mkstemp(&path[0]));
+                spillPath_ = path;
+                
+                Write(data_.data(), data_.size());
+                std::string().swap(data_);
+            }
+            
+            if (file_ == -1)
+            {
+                data_.append(bytes, size);
+            }
+            else
+            {
+                Write(bytes, size);
+            }
+            
+            return size;
+        }
+        
+        virtual int_type overflow(int_type next)
+        {
+            if (!traits_type::eq_int_type(next, traits_type::eof()))
+            {
+                char byte = traits_type::to_char_type(next);
+                xsputn(&byte, 1);
+            }
+            
+            return traits_type::not_eof(next);
+        }
+        
+    private:
+        void Write(const char *bytes, size_t size)
+        {
+            while (size != 0)
+            {
+                ssize_t written;
+                _syscall(written = write(file_, bytes, size));
+                
+                bytes += written;
+                size -= written;
+            }
+        }
+        
+        std::string &data_;
+        std::string &spillPath_;
+        size_t threshold_;
+        int file_;
+    };
+    
+    // Inflates archive entries ahead of ArchiveFolder::Open, each worker through its own unzFile.
+    class ArchiveFolder::Prefetcher
+    {
+    public:
+        Prefetcher(const std::string &archivePath, const std::map<std::string, Entry> &entries, std::vector<std::string> order, size_t threads, size_t budget)
+            : entries_(entries), order_(std::move(order)), next_(0), size_(0), budget_(budget), stopped_(false)
+        {
+            zlib_filefunc_def filefunc;
+            fill_pread_filefunc(&filefunc);
+            
+            for (size_t i = 0; i < threads; i++)
+            {
+                unzFile archive = unzOpen2(archivePath.c_str(), &filefunc);
+                if (archive == NULL)
+                {
+                    break;
+                }
+                
+                archives_.push_back(archive);
+                threads_.emplace_back([this, archive]() { Run(archive); });
+            }
+        }
+        
+        ~Prefetcher()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopped_ = true;
+            }
+            
+            condition_.notify_all();
+            
+            for (auto &thread : threads_)
+            {
+                thread.join();
+            }
+            
+            for (auto archive : archives_)
+            {
+                unzClose(archive);
+            }
+        }
+        
+        // Returns false if path wasn't prefetched, in which case the caller reads it itself.
+        bool Take(const std::string &path, std::string &data)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            
+            auto file = files_.find(path);
+            if (file == files_.end())
+            {
+                // Don't bother inflating it later on.
+                opened_.insert(path);
+                return false;
+            }
+            
+            condition_.wait(lock, [&]() { return file->second.ready; });
+            
+            bool success = !file->second.failed;
+            if (success)
+            {
+                data.swap(file->second.data);
+            }
+            
+            size_t index = file->second.index;
+            Release(file);
+            
+            // ldid has moved past anything scheduled before this file, so whatever it skipped is only taking up room.
+            for (auto file = files_.begin(); file != files_.end();)
+            {
+                if (file->second.ready && file->second.index < index)
+                {
+                    Release(file++);
+                }
+                else
+                {
+                    ++file;
+                }
+            }
+            
+            condition_.notify_all();
+            return success;
+        }
+        
+    private:
+        struct File
+        {
+            size_t index;
+            bool ready;
+            bool failed;
+            std::string data;
+        };
+        
+        void Run(unzFile archive)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            
+            while (true)
+            {
+                // Always allow one file in flight, however large, so a file bigger than the budget can't stall us.
+                condition_.wait(lock, [&]() { return stopped_ || next_ == order_.size() || size_ < budget_; });
+                
+                if (stopped_ || next_ == order_.size())
+                {
+                    return;
                 }
+                
+                size_t index = next_++;
+                const std::string &path = order_[index];
+                
+                if (opened_.find(path) != opened_.end())
+                {
+                    continue;
+                }
+                
+                const Entry &entry = entries_.at(path);
+                
+                File &file = files_[path];
+                file.index = index;
+                file.ready = false;
+                file.failed = false;
+                size_ += entry.size;
+                
+                lock.unlock();
+                
+                std::string data;
+                bool failed = false;
+                
+                try
+                {
+                    ArchiveFolder::Read(archive, entry, path, data);
+                }
+                catch (...)
+                {
+                    // Open reads it again on the signing thread, which reports the error properly.
+                    failed = true;
+                }
+                
+                lock.lock();
+                
+                File &result = files_.at(path);
+                result.data.swap(data);
+                result.ready = true;
+                result.failed = failed;
+                
+                condition_.notify_all();
+            }
+        }
+        
+        void Release(std::map<std::string, File>::iterator file)
+        {
+            size_ -= entries_.at(file->first).size;
+            files_.erase(file);
+        }
+        
+        const std::map<std::string, Entry> &entries_;
+        std::vector<std::string> order_;
+        
+        size_t next_;
+        size_t size_;
+        size_t budget_;
+        bool stopped_;
+        
+        std::map<std::string, File> files_;
+        std::set<std::string> opened_;
+        
+        std::vector<unzFile> archives_;
+        std::vector<std::thread> threads_;
+        
+        std::mutex mutex_;
+        std::condition_variable condition_;
+    };
+    
+    ArchiveFolder::ArchiveFolder(const std::string &archivePath, const std::string &root, size_t spillThreshold) : archivePath_(archivePath), root_(root), spillThreshold_(spillThreshold)
+    {
+        if (!root_.empty() && root_[root_.size() - 1] != '/')
+        {
+            root_ += '/';
+        }
+        
+        zlib_filefunc_def filefunc;
+        fill_pread_filefunc(&filefunc);
+        
+        archive_ = unzOpen2(archivePath.c_str(), &filefunc);
+        _assert_(archive_ != NULL, "unable to open %s", archivePath.c_str());
+        
+        std::vector<char> filename(256);
+        
+        for (int error = unzGoToFirstFile(archive_); error != UNZ_END_OF_LIST_OF_FILE; error = unzGoToNextFile(archive_))
+        {
+            _assert_(error == UNZ_OK, "unable to read %s", archivePath.c_str());
+            
+            unz_file_info info;
+            _assert_(unzGetCurrentFileInfo(archive_, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK, "unable to read %s", archivePath.c_str());
+            
+            if (info.size_filename + 1 > filename.size())
+            {
+                filename.resize(info.size_filename + 1);
             }
+            
+            _assert_(unzGetCurrentFileInfo(archive_, &info, filename.data(), filename.size(), NULL, 0, NULL, 0) == UNZ_OK, "unable to read %s", archivePath.c_str());
+            
+            std::string name(filename.data(), info.size_filename);
+            if (name.size() <= root_.size() || name.compare(0, root_.size(), root_) != 0)
+            {
+                continue;
+            }
+            
+            Entry entry;
+            unzGetFilePos(archive_, &entry.position);
+            entry.size = info.uncompressed_size;
+            entry.externalAttributes = info.external_fa;
+            
+            entries_[name.substr(root_.size())] = entry;
         }
+    }
+    
+    ArchiveFolder::~ArchiveFolder()
+    {
+        prefetcher_.reset();
         
-        // No entitlements found in any mach_header, so return empty string.
-        return "";
+        for (auto &change : changes_)
+        {
+            if (!change.second.spillPath.empty())
+            {
+                unlink(change.second.spillPath.c_str());
+            }
+        }
+        
+        unzClose(archive_);
+    }
+    
+    void ArchiveFolder::Read(const Entry &entry, const std::string &path, std::string &data) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Read(archive_, entry, path, data);
     }
     
+    void ArchiveFolder::Read(unzFile archive, const Entry &entry, const std::string &path, std::string &data)
+    {
+        unz_file_pos position = entry.position;
+        _assert_(unzGoToFilePos(archive, &position) == UNZ_OK, "unable to find %s", path.c_str());
+        _assert_(unzOpenCurrentFile(archive) == UNZ_OK, "unable to open %s", path.c_str());
+        
+        data.resize(entry.size);
+        
+        size_t offset = 0;
+        while (offset < data.size())
+        {
+            // unzReadCurrentFile takes an unsigned length, so read anything larger in pieces.
+            unsigned length = unsigned(std::min<size_t>(data.size() - offset, 0x40000000));
+            
+            int count = unzReadCurrentFile(archive, &data[offset], length);
+            _assert_(count > 0, "unable to read %s", path.c_str());
+            
+            offset += count;
+        }
+        
+        _assert_(unzCloseCurrentFile(archive) == UNZ_OK, "corrupt data in %s", path.c_str());
+    }
+    
+    void ArchiveFolder::Save(const std::string &path, bool edit, const void *flag, const Functor<void (std::streambuf &)> &code)
+    {
+        if (!edit)
+        {
+            NullBuffer save;
+            code(save);
+            return;
+        }
+        
+        Change change;
+        
+        {
+            SpillBuffer save(change.data, change.spillPath, spillThreshold_);
+            code(save);
+        }
+        
+        auto existing = changes_.find(path);
+        if (existing != changes_.end() && !existing->second.spillPath.empty())
+        {
+            unlink(existing->second.spillPath.c_str());
+        }
+        
+        changes_[path] = std::move(change);
+    }
+    
+    bool ArchiveFolder::Look(const std::string &path) const
+    {
+        if (changes_.find(path) != changes_.end() || entries_.find(path) != entries_.end())
+        {
+            return true;
+        }
+        
+        // Archives don't always store entries for directories, so also look for anything inside one.
+        std::string directory = path;
+        if (directory.empty() || directory[directory.size() - 1] != '/')
+        {
+            directory += '/';
+        }
+        
+        auto entry = entries_.lower_bound(directory);
+        return entry != entries_.end() && entry->first.compare(0, directory.size(), directory) == 0;
+    }
+    
+    void ArchiveFolder::Open(const std::string &path, const Functor<void (std::streambuf &, size_t, const void *)> &code) const
+    {
+        auto change = changes_.find(path);
+        if (change != changes_.end())
+        {
+            if (change->second.spillPath.empty())
+            {
+                MemoryBuffer buffer(change->second.data);
+                code(buffer, change->second.data.size(), NULL);
+            }
+            else
+            {
+                std::filebuf buffer;
+                _assert_(buffer.open(change->second.spillPath, std::ios::in | std::ios::binary) != NULL, "unable to open %s", path.c_str());
+                
+                size_t size = buffer.pubseekoff(0, std::ios::end, std::ios::in);
+                buffer.pubseekpos(0, std::ios::in);
+                
+                code(buffer, size, NULL);
+            }
+            
+            return;
+        }
+        
+        auto entry = entries_.find(path);
+        _assert_(entry != entries_.end(), "unable to find %s", path.c_str());
+        
+        std::string data;
+        if (prefetcher_ == nullptr || !prefetcher_->Take(path, data))
+        {
+            Read(entry->second, path, data);
+        }
+        
+        MemoryBuffer buffer(data);
+        code(buffer, data.size(), NULL);
+    }
+    
+    void ArchiveFolder::Find(const std::string &path, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const
+    {
+        std::string directory = path;
+        if (!directory.empty() && directory[directory.size() - 1] != '/')
+        {
+            directory += '/';
+        }
+        
+        auto contains = [&](const std::string &name) {
+            return name.compare(0, directory.size(), directory) == 0;
+        };
+        
+        auto entry = entries_.lower_bound(directory);
+        auto change = changes_.lower_bound(directory);
+        
+        // Walk both maps in order, so files saved since the archive was opened (e.g. a new embedded.mobileprovision) are
+        // listed too, and a saved file that replaces an archive entry is only listed once.
+        while (true)
+        {
+            bool hasEntry = entry != entries_.end() && contains(entry->first);
+            bool hasChange = change != changes_.end() && contains(change->first);
+            
+            if (!hasEntry && !hasChange)
+            {
+                break;
+            }
+            
+            if (hasChange && (!hasEntry || change->first <= entry->first))
+            {
+                if (hasEntry && entry->first == change->first)
+                {
+                    ++entry;
+                }
+                
+                code(change->first.substr(directory.size()));
+                ++change;
+                continue;
+            }
+            
+            const std::string &name = entry->first;
+            if (name[name.size() - 1] == '/')
+            {
+                ++entry;
+                continue;
+            }
+            
+            std::string relativePath = name.substr(directory.size());
+            
+            mode_t mode = (entry->second.externalAttributes >> 16) & S_IFMT;
+            if (mode == S_IFLNK)
+            {
+                link(relativePath, fun([&]() {
+                    std::string destination;
+                    Read(entry->second, name, destination);
+                    return destination;
+                }));
+            }
+            else
+            {
+                code(relativePath);
+            }
+            
+            ++entry;
+        }
+    }
+    
+    // Nested bundles are directories such as Frameworks/X.framework/ or PlugIns/X.appex/ with an Info.plist of their own.
+    // If path is such an Info.plist, sets bundle to its directory (ending in "/") and returns true.
+    static bool IsNestedBundleInfoPlist(const std::string &path, std::string &bundle)
+    {
+        static const std::regex nested("^(.*/)?[^/]+\\.(app|appex|framework)/Info\\.plist$");
+        static const std::string infoPlist("Info.plist");
+        
+        // std::regex is slow enough to dominate a walk over every file of a large bundle, so only try it on Info.plist files.
+        if (path.size() < infoPlist.size() || path.compare(path.size() - infoPlist.size(), infoPlist.size(), infoPlist) != 0)
+        {
+            return false;
+        }
+        
+        if (!std::regex_match(path, nested))
+        {
+            return false;
+        }
+        
+        bundle = path.substr(0, path.size() - infoPlist.size());
+        return true;
+    }
+    
+    void ArchiveFolder::Prefetch(size_t threads, size_t budget)
+    {
+        std::set<std::string> bundles;
+        bundles.insert("");
+        
+        for (auto &entry : entries_)
+        {
+            std::string bundle;
+            if (IsNestedBundleInfoPlist(entry.first, bundle))
+            {
+                bundles.insert(bundle);
+            }
+        }
+        
+        auto parent = [&](const std::string &path) -> std::string {
+            // Bundles are sorted, so the innermost one containing path is the last prefix before it.
+            for (auto bundle = bundles.lower_bound(path); bundle != bundles.begin();)
+            {
+                --bundle;
+                
+                if (*bundle != path && path.compare(0, bundle->size(), *bundle) == 0)
+                {
+                    return *bundle;
+                }
+            }
+            
+            return "";
+        };
+        
+        std::map<std::string, std::vector<std::string>> children;
+        std::map<std::string, std::vector<std::string>> files;
+        
+        for (auto &bundle : bundles)
+        {
+            if (!bundle.empty())
+            {
+                children[parent(bundle)].push_back(bundle);
+            }
+        }
+        
+        for (auto &entry : entries_)
+        {
+            const std::string &path = entry.first;
+            
+            mode_t mode = (entry.second.externalAttributes >> 16) & S_IFMT;
+            if (path[path.size() - 1] == '/' || mode == S_IFLNK || path.find("_CodeSignature/") != std::string::npos)
+            {
+                continue;
+            }
+            
+            files[parent(path)].push_back(path);
+        }
+        
+        // ldid::Sign signs every nested bundle before hashing its parent's files, so visit bundles depth-first, children first.
+        std::vector<std::string> order;
+        
+        std::function<void (const std::string &)> visit = [&](const std::string &bundle) {
+            for (auto &child : children[bundle])
+            {
+                visit(child);
+            }
+            
+            auto &contents = files[bundle];
+            order.insert(order.end(), contents.begin(), contents.end());
+        };
+        
+        visit("");
+        
+        prefetcher_.reset();
+        prefetcher_.reset(new Prefetcher(archivePath_, entries_, std::move(order), threads, budget));
+    }
+    
+    void ArchiveFolder::Changes(const Functor<void (const std::string &, const std::string &, const std::string &)> &code) const
+    {
+        for (auto &change : changes_)
+        {
+            code(root_ + change.first, change.second.data, change.second.spillPath);
+        }
+    }
 }
@@ -11,8 +11,123 @@
 #pragma once
 
 #include "ldid.hpp"
+#include "unzip.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 namespace ldid
 {
     std::string Entitlements(std::string path);
+    
+    // Same as above, for a Mach-O executable that's already in memory.
+    std::string Entitlements(const void *data, size_t size);
+    
+    // Calls code with the entitlements of the executable at path (or of the bundle's executable, if path is a directory)
+    // while it's still mapped, so they can be parsed in place without being copied out first. Empty if there are none.
+    void ReadEntitlements(std::string path, const Functor<void (const char *, size_t)> &code);
+    
+    // Same as above, for a Mach-O executable that's already in memory. The range points into data.
+    std::pair<const char *, size_t> EntitlementsRange(const void *data, size_t size);
+    
+    // A Mach-O whose code signature has been located once, so its entitlements can be read in place without copying them.
+    class MachOIndex
+    {
+    public:
+        // Indexes a Mach-O that's already in memory. data must outlive the index.
+        MachOIndex(const void *data, size_t size);
+        
+        // Maps the executable at path, or the bundle's executable if path is a directory, for as long as the index exists.
+        MachOIndex(const std::string &path);
+        ~MachOIndex();
+        
+        // Points into the binary at the entitlements of the first slice that has any. Empty if none do.
+        std::pair<const char *, size_t> Entitlements() const;
+        
+    private:
+        class Mapping;
+        
+        void Parse(const uint8_t *data, size_t size);
+        
+        std::unique_ptr<Mapping> mapping_;
+        
+        std::pair<const char *, size_t> entitlements_;
+    };
+    
+    // Everything inside a bundle directory, found by walking it once.
+    struct BundleManifest
+    {
+        struct File
+        {
+            // Relative to the bundle; directories end in "/".
+            std::string path;
+            
+            mode_t mode;
+            off_t size;
+        };
+        
+        // Every file, directory and symlink, sorted by path.
+        std::vector<File> files;
+    };
+    
+    // Walks the bundle at root on a pool of threads sharing one queue of directories left to read, so counting files for
+    // progress and finding app extensions can both use the manifest instead of enumerating the bundle again.
+    BundleManifest ScanBundle(const std::string &root, size_t threads);
+    
+    // Folder backed by the bundle at root inside a zip archive (e.g. "Payload/App.app/" in an .ipa).
+    // Files are read straight from the archive, and whatever is saved is kept in memory,
+    // or in a temporary file once larger than spillThreshold, so nothing is extracted to disk.
+    class ArchiveFolder : public Folder
+    {
+    public:
+        ArchiveFolder(const std::string &archivePath, const std::string &root, size_t spillThreshold = 16 * 1024 * 1024);
+        virtual ~ArchiveFolder();
+        
+        virtual void Save(const std::string &path, bool edit, const void *flag, const Functor<void (std::streambuf &)> &code);
+        virtual bool Look(const std::string &path) const;
+        virtual void Open(const std::string &path, const Functor<void (std::streambuf &, size_t, const void *)> &code) const;
+        virtual void Find(const std::string &path, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const;
+        
+        // Calls code for every file saved so far with its path in the archive, and either its contents or the temporary file holding them.
+        void Changes(const Functor<void (const std::string &, const std::string &, const std::string &)> &code) const;
+        
+        // Starts inflating files on a pool of threads in the order ldid::Sign will open them: nested bundles
+        // innermost first, then their parents. At most budget bytes that haven't been opened yet are held at once.
+        void Prefetch(size_t threads, size_t budget = 256 * 1024 * 1024);
+        
+    private:
+        class Prefetcher;
+        
+        struct Entry
+        {
+            unz_file_pos position;
+            uLong size;
+            uLong externalAttributes;
+        };
+        
+        struct Change
+        {
+            std::string data;
+            std::string spillPath;
+        };
+        
+        void Read(const Entry &entry, const std::string &path, std::string &data) const;
+        static void Read(unzFile archive, const Entry &entry, const std::string &path, std::string &data);
+        
+        std::string archivePath_;
+        std::string root_;
+        size_t spillThreshold_;
+        
+        std::map<std::string, Entry> entries_;
+        std::map<std::string, Change> changes_;
+        
+        // minizip handles keep a read position, so every read goes through this lock.
+        mutable unzFile archive_;
+        mutable std::mutex mutex_;
+        
+        std::unique_ptr<Prefetcher> prefetcher_;
+    };
 }
@@ -10,6 +10,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "zlib.h"
 #include "ioapi.h"
 
@@ -141,7 +147,8 @@ long ZCALLBACK fseek_file_func (opaque, stream, offset, origin)
     default: return -1;
     }
     ret = 0;
-    fseek((FILE *)stream, offset, fseek_origin);
+    if (fseek((FILE *)stream, offset, fseek_origin) != 0)
+        ret = -1;
     return ret;
 }
 
@@ -175,3 +182,298 @@ void fill_fopen_filefunc (pzlib_filefunc_def)
     pzlib_filefunc_def->zerror_file = ferror_file_func;
     pzlib_filefunc_def->opaque = NULL;
 }
+
+
+/* Descriptor-based streams used by the mmap and pread backends.
+   Every stream keeps its own offset and never touches the descriptor's
+   file position, so a zlib_filefunc_def filled by these functions can be
+   shared by any number of threads, each opening its own stream. */
+
+typedef struct file_stream_s
+{
+    int fd;
+    const unsigned char* base; /* read-only mapping, or NULL for pread streams */
+    uLong size;
+    uLong offset;
+    int error;
+} file_stream;
+
+static voidpf open_file_stream OF((
+   const char* filename,
+   int mode,
+   int mapped));
+
+voidpf ZCALLBACK mmap_open_file_func OF((
+   voidpf opaque,
+   const char* filename,
+   int mode));
+
+voidpf ZCALLBACK pread_open_file_func OF((
+   voidpf opaque,
+   const char* filename,
+   int mode));
+
+uLong ZCALLBACK pread_read_file_func OF((
+   voidpf opaque,
+   voidpf stream,
+   void* buf,
+   uLong size));
+
+uLong ZCALLBACK pwrite_write_file_func OF((
+   voidpf opaque,
+   voidpf stream,
+   const void* buf,
+   uLong size));
+
+long ZCALLBACK stream_tell_file_func OF((
+   voidpf opaque,
+   voidpf stream));
+
+long ZCALLBACK stream_seek_file_func OF((
+   voidpf opaque,
+   voidpf stream,
+   uLong offset,
+   int origin));
+
+int ZCALLBACK stream_close_file_func OF((
+   voidpf opaque,
+   voidpf stream));
+
+int ZCALLBACK stream_error_file_func OF((
+   voidpf opaque,
+   voidpf stream));
+
+
+static voidpf open_file_stream (filename, mode, mapped)
+   const char* filename;
+   int mode;
+   int mapped;
+{
+    file_stream* stream;
+    struct stat st;
+    int flags;
+    int fd;
+
+    if ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER)==ZLIB_FILEFUNC_MODE_READ)
+        flags = O_RDONLY;
+    else
+    if (mode & ZLIB_FILEFUNC_MODE_EXISTING)
+        flags = O_RDWR;
+    else
+    if (mode & ZLIB_FILEFUNC_MODE_CREATE)
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+    else
+        return NULL;
+
+    if (filename==NULL)
+        return NULL;
+
+    do
+    {
+        fd = open(filename, flags | O_CLOEXEC, 0666);
+    } while (fd < 0 && errno == EINTR);
+
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    stream = (file_stream*)malloc(sizeof(file_stream));
+    if (stream==NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    stream->fd = fd;
+    stream->base = NULL;
+    stream->size = (uLong)st.st_size;
+    stream->offset = 0;
+    stream->error = 0;
+
+    /* Only read-only streams are mapped; writers (and empty files, which
+       can't be mapped) go through pread/pwrite instead. */
+    if (mapped && flags == O_RDONLY && stream->size > 0)
+    {
+        void* base = mmap(NULL, (size_t)stream->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (base != MAP_FAILED)
+            stream->base = (const unsigned char*)base;
+    }
+
+    return stream;
+}
+
+voidpf ZCALLBACK mmap_open_file_func (opaque, filename, mode)
+   voidpf opaque;
+   const char* filename;
+   int mode;
+{
+    return open_file_stream(filename, mode, 1);
+}
+
+voidpf ZCALLBACK pread_open_file_func (opaque, filename, mode)
+   voidpf opaque;
+   const char* filename;
+   int mode;
+{
+    return open_file_stream(filename, mode, 0);
+}
+
+uLong ZCALLBACK pread_read_file_func (opaque, stream, buf, size)
+   voidpf opaque;
+   voidpf stream;
+   void* buf;
+   uLong size;
+{
+    file_stream* s = (file_stream*)stream;
+    uLong ret = 0;
+
+    if (s->base != NULL)
+    {
+        if (s->offset < s->size)
+        {
+            ret = s->size - s->offset;
+            if (ret > size)
+                ret = size;
+            memcpy(buf, s->base + s->offset, (size_t)ret);
+        }
+        s->offset += ret;
+        return ret;
+    }
+
+    while (ret < size)
+    {
+        ssize_t count = pread(s->fd, (char*)buf + ret, (size_t)(size - ret), (off_t)(s->offset + ret));
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            s->error = errno;
+            break;
+        }
+        if (count == 0)
+            break;
+        ret += (uLong)count;
+    }
+    s->offset += ret;
+    return ret;
+}
+
+uLong ZCALLBACK pwrite_write_file_func (opaque, stream, buf, size)
+   voidpf opaque;
+   voidpf stream;
+   const void* buf;
+   uLong size;
+{
+    file_stream* s = (file_stream*)stream;
+    uLong ret = 0;
+
+    if (s->base != NULL)
+    {
+        s->error = EBADF;
+        return 0;
+    }
+
+    while (ret < size)
+    {
+        ssize_t count = pwrite(s->fd, (const char*)buf + ret, (size_t)(size - ret), (off_t)(s->offset + ret));
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            s->error = errno;
+            break;
+        }
+        ret += (uLong)count;
+    }
+    s->offset += ret;
+    if (s->offset > s->size)
+        s->size = s->offset;
+    return ret;
+}
+
+long ZCALLBACK stream_tell_file_func (opaque, stream)
+   voidpf opaque;
+   voidpf stream;
+{
+    file_stream* s = (file_stream*)stream;
+    return (long)s->offset;
+}
+
+long ZCALLBACK stream_seek_file_func (opaque, stream, offset, origin)
+   voidpf opaque;
+   voidpf stream;
+   uLong offset;
+   int origin;
+{
+    file_stream* s = (file_stream*)stream;
+    uLong position;
+    switch (origin)
+    {
+    case ZLIB_FILEFUNC_SEEK_CUR :
+        position = s->offset + offset;
+        break;
+    case ZLIB_FILEFUNC_SEEK_END :
+        position = s->size + offset;
+        break;
+    case ZLIB_FILEFUNC_SEEK_SET :
+        position = offset;
+        break;
+    default: return -1;
+    }
+    if ((long)position < 0)
+        return -1;
+    s->offset = position;
+    return 0;
+}
+
+int ZCALLBACK stream_close_file_func (opaque, stream)
+   voidpf opaque;
+   voidpf stream;
+{
+    file_stream* s = (file_stream*)stream;
+    int ret;
+    if (s->base != NULL)
+        munmap((void*)s->base, (size_t)s->size);
+    ret = close(s->fd);
+    free(s);
+    return ret;
+}
+
+int ZCALLBACK stream_error_file_func (opaque, stream)
+   voidpf opaque;
+   voidpf stream;
+{
+    file_stream* s = (file_stream*)stream;
+    return s->error;
+}
+
+void fill_mmap_filefunc (pzlib_filefunc_def)
+  zlib_filefunc_def* pzlib_filefunc_def;
+{
+    pzlib_filefunc_def->zopen_file = mmap_open_file_func;
+    pzlib_filefunc_def->zread_file = pread_read_file_func;
+    pzlib_filefunc_def->zwrite_file = pwrite_write_file_func;
+    pzlib_filefunc_def->ztell_file = stream_tell_file_func;
+    pzlib_filefunc_def->zseek_file = stream_seek_file_func;
+    pzlib_filefunc_def->zclose_file = stream_close_file_func;
+    pzlib_filefunc_def->zerror_file = stream_error_file_func;
+    pzlib_filefunc_def->opaque = NULL;
+}
+
+void fill_pread_filefunc (pzlib_filefunc_def)
+  zlib_filefunc_def* pzlib_filefunc_def;
+{
+    pzlib_filefunc_def->zopen_file = pread_open_file_func;
+    pzlib_filefunc_def->zread_file = pread_read_file_func;
+    pzlib_filefunc_def->zwrite_file = pwrite_write_file_func;
+    pzlib_filefunc_def->ztell_file = stream_tell_file_func;
+    pzlib_filefunc_def->zseek_file = stream_seek_file_func;
+    pzlib_filefunc_def->zclose_file = stream_close_file_func;
+    pzlib_filefunc_def->zerror_file = stream_error_file_func;
+    pzlib_filefunc_def->opaque = NULL;
+}
@@ -59,6 +59,13 @@ typedef struct zlib_filefunc_def_s
 
 void fill_fopen_filefunc OF((zlib_filefunc_def* pzlib_filefunc_def));
 
+/* Read-only streams are served from a read-only mmap of the whole file;
+   write streams fall back to pwrite. */
+void fill_mmap_filefunc OF((zlib_filefunc_def* pzlib_filefunc_def));
+
+/* All reads and writes go through pread/pwrite at a per-stream offset. */
+void fill_pread_filefunc OF((zlib_filefunc_def* pzlib_filefunc_def));
+
 #define ZREAD(filefunc,filestream,buf,size) ((*((filefunc).zread_file))((filefunc).opaque,filestream,buf,size))
 #define ZWRITE(filefunc,filestream,buf,size) ((*((filefunc).zwrite_file))((filefunc).opaque,filestream,buf,size))
 #define ZTELL(filefunc,filestream) ((*((filefunc).ztell_file))((filefunc).opaque,filestream))
@@ -84,6 +84,12 @@ woven in by Terry Thorsen 1/2003.
 #define SIZECENTRALDIRITEM (0x2e)
 #define SIZEZIPLOCALHEADER (0x1e)
 
+#define ZIP64ENDHEADERMAGIC    (0x06064b50)
+#define ZIP64ENDLOCATORMAGIC   (0x07064b50)
+#define SIZEZIP64ENDLOCATOR    (0x14)
+#define ZIP64EXTRAHEADERID     (0x0001)
+#define MAXU32                 (0xffffffff)
+
 
 
 
@@ -123,6 +129,25 @@ typedef struct
 } file_in_zip_read_info_s;
 
 
+/* unz_index_entry_s and unz_index_s contain the name index built by
+    unzBuildIndex */
+typedef struct
+{
+    uLong hash;                 /* hash of the case-folded filename */
+    uLong offset_filename;      /* offset of the filename in names */
+    unz_file_pos file_pos;      /* where the file is in the central dir */
+} unz_index_entry;
+
+typedef struct
+{
+    unz_index_entry* entries;   /* one per file, in central dir order */
+    uLong number_entry;
+    uLong* buckets;             /* 1 + index in entries, 0 for an empty slot */
+    uLong number_bucket;        /* always a power of 2 */
+    char* names;                /* the filenames, each ending with a '\0' */
+} unz_index;
+
+
 /* unz_s contain internal information about the zipfile
 */
 typedef struct
@@ -145,6 +170,7 @@ typedef struct
     file_in_zip_read_info_s* pfile_in_zip_read; /* structure about the current
                                         file if we are decompressing it */
     int encrypted;
+    unz_index* index;           /* filename index, NULL until unzBuildIndex */
 #    ifndef NOUNCRYPT
     unsigned long keys[3];     /* keys defining the pseudo-random sequence */
     const unsigned long* pcrc_32_tab;
@@ -257,6 +283,31 @@ local int unzlocal_getLong (pzlib_filefunc_def,filestream,pX)
     return err;
 }
 
+/* Zip64 fields are 8 bytes wide; this relies on uLong being 64-bit (LP64) */
+local int unzlocal_getLong64 OF((
+    const zlib_filefunc_def* pzlib_filefunc_def,
+    voidpf filestream,
+    uLong *pX));
+
+local int unzlocal_getLong64 (pzlib_filefunc_def,filestream,pX)
+    const zlib_filefunc_def* pzlib_filefunc_def;
+    voidpf filestream;
+    uLong *pX;
+{
+    uLong low, high;
+    int err;
+
+    err = unzlocal_getLong(pzlib_filefunc_def,filestream,&low);
+    if (err==UNZ_OK)
+        err = unzlocal_getLong(pzlib_filefunc_def,filestream,&high);
+
+    if (err==UNZ_OK)
+        *pX = low + (high<<16<<16);
+    else
+        *pX = 0;
+    return err;
+}
+
 
 /* My own strcmpi / strcasecmp */
 local int strcmpcasenosensitive_internal (fileName1,fileName2)
@@ -385,6 +436,55 @@ local uLong unzlocal_SearchCentralDir(pzlib_filefunc_def,filestream)
     return uPosFound;
 }
 
+/*
+  Locate the Zip64 end of central directory record, using the locator that
+    sits right before the end of central directory record at endcentral_pos.
+  Returns 0 if the zipfile isn't a Zip64 archive.
+*/
+local uLong unzlocal_SearchCentralDir64 OF((
+    const zlib_filefunc_def* pzlib_filefunc_def,
+    voidpf filestream,
+    uLong endcentral_pos));
+
+local uLong unzlocal_SearchCentralDir64(pzlib_filefunc_def,filestream,endcentral_pos)
+    const zlib_filefunc_def* pzlib_filefunc_def;
+    voidpf filestream;
+    uLong endcentral_pos;
+{
+    uLong uL;
+    uLong number_disk;
+    uLong offset_end64;
+
+    if (endcentral_pos < SIZEZIP64ENDLOCATOR)
+        return 0;
+
+    if (ZSEEK(*pzlib_filefunc_def,filestream,endcentral_pos-SIZEZIP64ENDLOCATOR,
+              ZLIB_FILEFUNC_SEEK_SET)!=0)
+        return 0;
+
+    if ((unzlocal_getLong(pzlib_filefunc_def,filestream,&uL)!=UNZ_OK) ||
+        (uL!=ZIP64ENDLOCATORMAGIC))
+        return 0;
+
+    /* number of the disk with the start of the zip64 end of central directory */
+    if ((unzlocal_getLong(pzlib_filefunc_def,filestream,&number_disk)!=UNZ_OK) ||
+        (number_disk!=0))
+        return 0;
+
+    /* relative offset of the zip64 end of central directory record */
+    if (unzlocal_getLong64(pzlib_filefunc_def,filestream,&offset_end64)!=UNZ_OK)
+        return 0;
+
+    if (ZSEEK(*pzlib_filefunc_def,filestream,offset_end64,ZLIB_FILEFUNC_SEEK_SET)!=0)
+        return 0;
+
+    if ((unzlocal_getLong(pzlib_filefunc_def,filestream,&uL)!=UNZ_OK) ||
+        (uL!=ZIP64ENDHEADERMAGIC))
+        return 0;
+
+    return offset_end64;
+}
+
 /*
   Open a Zip file. path contain the full pathname (by example,
      on a Windows NT computer "c:\\test\\zlib114.zip" or on an Unix computer
@@ -401,6 +501,8 @@ extern unzFile ZEXPORT unzOpen2 (path, pzlib_filefunc_def)
     unz_s us;
     unz_s *s;
     uLong central_pos,uL;
+    uLong central_pos64=0;      /* position of the zip64 end of central dir, if any */
+    uLong end_of_central_dir;   /* where the central directory should end */
 
     uLong number_disk;          /* number of the current dist, used for
                                    spaning ZIP, unsupported, always 0*/
@@ -431,49 +533,115 @@ extern unzFile ZEXPORT unzOpen2 (path, pzlib_filefunc_def)
     if (central_pos==0)
         err=UNZ_ERRNO;
 
-    if (ZSEEK(us.z_filefunc, us.filestream,
-                                      central_pos,ZLIB_FILEFUNC_SEEK_SET)!=0)
-        err=UNZ_ERRNO;
+    if (err==UNZ_OK)
+        central_pos64 = unzlocal_SearchCentralDir64(&us.z_filefunc,us.filestream,central_pos);
 
-    /* the signature, already checked */
-    if (unzlocal_getLong(&us.z_filefunc, us.filestream,&uL)!=UNZ_OK)
-        err=UNZ_ERRNO;
+    if (central_pos64!=0)
+    {
+        uLong size_end64;
+        uLong version;
 
-    /* number of this disk */
-    if (unzlocal_getShort(&us.z_filefunc, us.filestream,&number_disk)!=UNZ_OK)
-        err=UNZ_ERRNO;
+        if (ZSEEK(us.z_filefunc, us.filestream,
+                                          central_pos64,ZLIB_FILEFUNC_SEEK_SET)!=0)
+            err=UNZ_ERRNO;
 
-    /* number of the disk with the start of the central directory */
-    if (unzlocal_getShort(&us.z_filefunc, us.filestream,&number_disk_with_CD)!=UNZ_OK)
-        err=UNZ_ERRNO;
+        /* the signature, already checked */
+        if (unzlocal_getLong(&us.z_filefunc, us.filestream,&uL)!=UNZ_OK)
+            err=UNZ_ERRNO;
 
-    /* total number of entries in the central dir on this disk */
-    if (unzlocal_getShort(&us.z_filefunc, us.filestream,&us.gi.number_entry)!=UNZ_OK)
-        err=UNZ_ERRNO;
+        /* size of the zip64 end of central directory record */
+        if (unzlocal_getLong64(&us.z_filefunc, us.filestream,&size_end64)!=UNZ_OK)
+            err=UNZ_ERRNO;
 
-    /* total number of entries in the central dir */
-    if (unzlocal_getShort(&us.z_filefunc, us.filestream,&number_entry_CD)!=UNZ_OK)
-        err=UNZ_ERRNO;
+        /* version made by, version needed to extract */
+        if (unzlocal_getShort(&us.z_filefunc, us.filestream,&version)!=UNZ_OK)
+            err=UNZ_ERRNO;
+        if (unzlocal_getShort(&us.z_filefunc, us.filestream,&version)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* number of this disk */
+        if (unzlocal_getLong(&us.z_filefunc, us.filestream,&number_disk)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* number of the disk with the start of the central directory */
+        if (unzlocal_getLong(&us.z_filefunc, us.filestream,&number_disk_with_CD)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* total number of entries in the central dir on this disk */
+        if (unzlocal_getLong64(&us.z_filefunc, us.filestream,&us.gi.number_entry)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* total number of entries in the central dir */
+        if (unzlocal_getLong64(&us.z_filefunc, us.filestream,&number_entry_CD)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* size of the central directory */
+        if (unzlocal_getLong64(&us.z_filefunc, us.filestream,&us.size_central_dir)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* offset of start of central directory with respect to the
+              starting disk number */
+        if (unzlocal_getLong64(&us.z_filefunc, us.filestream,&us.offset_central_dir)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* the zipfile comment length is only in the regular record */
+        if (ZSEEK(us.z_filefunc, us.filestream,
+                                          central_pos+20,ZLIB_FILEFUNC_SEEK_SET)!=0)
+            err=UNZ_ERRNO;
+
+        if (unzlocal_getShort(&us.z_filefunc, us.filestream,&us.gi.size_comment)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        end_of_central_dir = central_pos64;
+    }
+    else
+    {
+        if (ZSEEK(us.z_filefunc, us.filestream,
+                                          central_pos,ZLIB_FILEFUNC_SEEK_SET)!=0)
+            err=UNZ_ERRNO;
+
+        /* the signature, already checked */
+        if (unzlocal_getLong(&us.z_filefunc, us.filestream,&uL)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* number of this disk */
+        if (unzlocal_getShort(&us.z_filefunc, us.filestream,&number_disk)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* number of the disk with the start of the central directory */
+        if (unzlocal_getShort(&us.z_filefunc, us.filestream,&number_disk_with_CD)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* total number of entries in the central dir on this disk */
+        if (unzlocal_getShort(&us.z_filefunc, us.filestream,&us.gi.number_entry)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* total number of entries in the central dir */
+        if (unzlocal_getShort(&us.z_filefunc, us.filestream,&number_entry_CD)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* size of the central directory */
+        if (unzlocal_getLong(&us.z_filefunc, us.filestream,&us.size_central_dir)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* offset of start of central directory with respect to the
+              starting disk number */
+        if (unzlocal_getLong(&us.z_filefunc, us.filestream,&us.offset_central_dir)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        /* zipfile comment length */
+        if (unzlocal_getShort(&us.z_filefunc, us.filestream,&us.gi.size_comment)!=UNZ_OK)
+            err=UNZ_ERRNO;
+
+        end_of_central_dir = central_pos;
+    }
 
     if ((number_entry_CD!=us.gi.number_entry) ||
         (number_disk_with_CD!=0) ||
         (number_disk!=0))
         err=UNZ_BADZIPFILE;
 
-    /* size of the central directory */
-    if (unzlocal_getLong(&us.z_filefunc, us.filestream,&us.size_central_dir)!=UNZ_OK)
-        err=UNZ_ERRNO;
-
-    /* offset of start of central directory with respect to the
-          starting disk number */
-    if (unzlocal_getLong(&us.z_filefunc, us.filestream,&us.offset_central_dir)!=UNZ_OK)
-        err=UNZ_ERRNO;
-
-    /* zipfile comment length */
-    if (unzlocal_getShort(&us.z_filefunc, us.filestream,&us.gi.size_comment)!=UNZ_OK)
-        err=UNZ_ERRNO;
-
-    if ((central_pos<us.offset_central_dir+us.size_central_dir) &&
+    if ((end_of_central_dir<us.offset_central_dir+us.size_central_dir) &&
         (err==UNZ_OK))
         err=UNZ_BADZIPFILE;
 
@@ -483,11 +651,12 @@ extern unzFile ZEXPORT unzOpen2 (path, pzlib_filefunc_def)
         return NULL;
     }
 
-    us.byte_before_the_zipfile = central_pos -
+    us.byte_before_the_zipfile = end_of_central_dir -
                             (us.offset_central_dir+us.size_central_dir);
     us.central_pos = central_pos;
     us.pfile_in_zip_read = NULL;
     us.encrypted = 0;
+    us.index = NULL;
 
 
     s=(unz_s*)ALLOC(sizeof(unz_s));
@@ -503,6 +672,17 @@ extern unzFile ZEXPORT unzOpen (path)
     return unzOpen2(path, NULL);
 }
 
+local void unzlocal_FreeIndex OF((unz_index* index));
+
+local void unzlocal_FreeIndex (index)
+    unz_index* index;
+{
+    TRYFREE(index->entries);
+    TRYFREE(index->buckets);
+    TRYFREE(index->names);
+    TRYFREE(index);
+}
+
 /*
   Close a ZipFile opened with unzipOpen.
   If there is files inside the .Zip opened with unzipOpenCurrentFile (see later),
@@ -519,6 +699,9 @@ extern int ZEXPORT unzClose (file)
     if (s->pfile_in_zip_read!=NULL)
         unzCloseCurrentFile(file);
 
+    if (s->index!=NULL)
+        unzlocal_FreeIndex(s->index);
+
     ZCLOSE(s->z_filefunc, s->filestream);
     TRYFREE(s);
     return UNZ_OK;
@@ -725,6 +908,72 @@ local int unzlocal_GetCurrentFileInfoInternal (file,
     else
         lSeek+=file_info.size_file_comment;
 
+    /* values that don't fit in 32 bits are stored in the Zip64 extra field */
+    if ((err==UNZ_OK) && (file_info.size_file_extra>0) &&
+        ((file_info.uncompressed_size==MAXU32) ||
+         (file_info.compressed_size==MAXU32) ||
+         (file_info_internal.offset_curfile==MAXU32)))
+    {
+        uLong extra_pos = s->pos_in_central_dir+s->byte_before_the_zipfile+
+                          SIZECENTRALDIRITEM+file_info.size_filename;
+        uLong extra_end = extra_pos+file_info.size_file_extra;
+
+        if (ZSEEK(s->z_filefunc, s->filestream,extra_pos,ZLIB_FILEFUNC_SEEK_SET)!=0)
+            err=UNZ_ERRNO;
+
+        while ((err==UNZ_OK) && (extra_pos+4<=extra_end))
+        {
+            uLong header_id, data_size;
+
+            if (unzlocal_getShort(&s->z_filefunc, s->filestream,&header_id) != UNZ_OK)
+                err=UNZ_ERRNO;
+            if (unzlocal_getShort(&s->z_filefunc, s->filestream,&data_size) != UNZ_OK)
+                err=UNZ_ERRNO;
+
+            if ((err==UNZ_OK) && (header_id==ZIP64EXTRAHEADERID))
+            {
+                /* the field must fit in the extra data, and each value in the field */
+                if (data_size > extra_end-extra_pos-4)
+                    err=UNZ_BADZIPFILE;
+
+                /* only the fields set to 0xffffffff in the header are present, in this order */
+                if ((err==UNZ_OK) && (file_info.uncompressed_size==MAXU32))
+                {
+                    if (data_size<8)
+                        err=UNZ_BADZIPFILE;
+                    else if (unzlocal_getLong64(&s->z_filefunc, s->filestream,&file_info.uncompressed_size) != UNZ_OK)
+                        err=UNZ_ERRNO;
+                    else
+                        data_size-=8;
+                }
+                if ((err==UNZ_OK) && (file_info.compressed_size==MAXU32))
+                {
+                    if (data_size<8)
+                        err=UNZ_BADZIPFILE;
+                    else if (unzlocal_getLong64(&s->z_filefunc, s->filestream,&file_info.compressed_size) != UNZ_OK)
+                        err=UNZ_ERRNO;
+                    else
+                        data_size-=8;
+                }
+                if ((err==UNZ_OK) && (file_info_internal.offset_curfile==MAXU32))
+                {
+                    if (data_size<8)
+                        err=UNZ_BADZIPFILE;
+                    else if (unzlocal_getLong64(&s->z_filefunc, s->filestream,&file_info_internal.offset_curfile) != UNZ_OK)
+                        err=UNZ_ERRNO;
+                    else
+                        data_size-=8;
+                }
+                break;
+            }
+
+            extra_pos += 4+data_size;
+            if ((err==UNZ_OK) &&
+                (ZSEEK(s->z_filefunc, s->filestream,extra_pos,ZLIB_FILEFUNC_SEEK_SET)!=0))
+                err=UNZ_ERRNO;
+        }
+    }
+
     if ((err==UNZ_OK) && (pfile_info!=NULL))
         *pfile_info=file_info;
 
@@ -813,6 +1062,174 @@ extern int ZEXPORT unzGoToNextFile (file)
 }
 
 
+/*
+  Hash a filename the same way whatever the case of its letters, so that
+    lookups in the index can be case sensitive or not (FNV-1a style).
+*/
+local uLong unzlocal_HashFileName OF((const char* fileName));
+
+local uLong unzlocal_HashFileName (fileName)
+    const char* fileName;
+{
+    uLong hash = 2166136261UL;
+    for (;;)
+    {
+        char c=*(fileName++);
+        if (c=='\0')
+            return hash;
+        if ((c>='a') && (c<='z'))
+            c -= 0x20;
+        hash = (hash ^ (unsigned char)c) * 16777619UL;
+    }
+}
+
+local uLong unzlocal_getValue_inmemory OF((const unsigned char* buf, int nbByte));
+
+local uLong unzlocal_getValue_inmemory (buf, nbByte)
+    const unsigned char* buf;
+    int nbByte;
+{
+    uLong x = 0;
+    int n;
+    for (n = nbByte - 1; n >= 0; n--)
+        x = (x << 8) + buf[n];
+    return x;
+}
+
+local int unzlocal_SearchIndex OF((const unz_index* index,
+                                   const char* szFileName,
+                                   int iCaseSensitivity,
+                                   unz_file_pos* file_pos));
+
+local int unzlocal_SearchIndex (index, szFileName, iCaseSensitivity, file_pos)
+    const unz_index* index;
+    const char* szFileName;
+    int iCaseSensitivity;
+    unz_file_pos* file_pos;
+{
+    uLong hash = unzlocal_HashFileName(szFileName);
+    uLong mask = index->number_bucket - 1;
+    uLong i;
+
+    /* files were inserted in central dir order, so the first match along
+       the probe sequence is the one a linear search would have found */
+    for (i = hash & mask; index->buckets[i] != 0; i = (i + 1) & mask)
+    {
+        const unz_index_entry* entry = &index->entries[index->buckets[i] - 1];
+        if ((entry->hash == hash) &&
+            (unzStringFileNameCompare(index->names + entry->offset_filename,
+                                      szFileName,iCaseSensitivity)==0))
+        {
+            *file_pos = entry->file_pos;
+            return UNZ_OK;
+        }
+    }
+
+    return UNZ_END_OF_LIST_OF_FILE;
+}
+
+/*
+  Read the whole central directory at once and index every file by name.
+*/
+extern int ZEXPORT unzBuildIndex (file)
+    unzFile file;
+{
+    unz_s* s;
+    unz_index* index;
+    unsigned char* central_dir;
+    uLong pos = 0;
+    uLong size_names = 0;
+    uLong i;
+    int err = UNZ_OK;
+
+    if (file==NULL)
+        return UNZ_PARAMERROR;
+    s=(unz_s*)file;
+
+    if (s->index!=NULL)
+        return UNZ_OK;
+
+    central_dir = (unsigned char*)ALLOC(s->size_central_dir + 1);
+    index = (unz_index*)ALLOC(sizeof(unz_index));
+    if ((central_dir==NULL) || (index==NULL))
+    {
+        TRYFREE(central_dir);
+        TRYFREE(index);
+        return UNZ_INTERNALERROR;
+    }
+
+    /* every central header takes more than SIZECENTRALDIRITEM bytes, and
+       holds a filename shorter than itself */
+    index->number_entry = 0;
+    index->number_bucket = 1;
+    while (index->number_bucket < 2 * (s->size_central_dir / SIZECENTRALDIRITEM + 1))
+        index->number_bucket <<= 1;
+    index->entries = (unz_index_entry*)ALLOC((s->size_central_dir / SIZECENTRALDIRITEM + 1) *
+                                             sizeof(unz_index_entry));
+    index->buckets = (uLong*)calloc(index->number_bucket, sizeof(uLong));
+    index->names = (char*)ALLOC(s->size_central_dir + 1);
+    if ((index->entries==NULL) || (index->buckets==NULL) || (index->names==NULL))
+        err=UNZ_INTERNALERROR;
+
+    if ((err==UNZ_OK) &&
+        (ZSEEK(s->z_filefunc, s->filestream,
+               s->offset_central_dir+s->byte_before_the_zipfile,
+               ZLIB_FILEFUNC_SEEK_SET)!=0))
+        err=UNZ_ERRNO;
+
+    if ((err==UNZ_OK) &&
+        (ZREAD(s->z_filefunc, s->filestream,central_dir,s->size_central_dir)!=s->size_central_dir))
+        err=UNZ_ERRNO;
+
+    while ((err==UNZ_OK) && (pos + SIZECENTRALDIRITEM <= s->size_central_dir))
+    {
+        const unsigned char* header = central_dir + pos;
+        uLong size_filename = unzlocal_getValue_inmemory(header+28,2);
+        uLong size_file_extra = unzlocal_getValue_inmemory(header+30,2);
+        uLong size_file_comment = unzlocal_getValue_inmemory(header+32,2);
+        unz_index_entry* entry = &index->entries[index->number_entry];
+
+        if ((unzlocal_getValue_inmemory(header,4)!=0x02014b50) ||
+            (pos + SIZECENTRALDIRITEM + size_filename > s->size_central_dir))
+        {
+            err=UNZ_BADZIPFILE;
+            break;
+        }
+
+        memcpy(index->names + size_names,header+SIZECENTRALDIRITEM,size_filename);
+        index->names[size_names + size_filename] = '\0';
+
+        entry->hash = unzlocal_HashFileName(index->names + size_names);
+        entry->offset_filename = size_names;
+        entry->file_pos.pos_in_zip_directory = s->offset_central_dir + pos;
+        entry->file_pos.num_of_file = index->number_entry;
+
+        size_names += size_filename + 1;
+        pos += SIZECENTRALDIRITEM + size_filename + size_file_extra + size_file_comment;
+        index->number_entry++;
+    }
+
+    TRYFREE(central_dir);
+
+    for (i = 0; (err==UNZ_OK) && (i < index->number_entry); i++)
+    {
+        uLong mask = index->number_bucket - 1;
+        uLong bucket = index->entries[i].hash & mask;
+        while (index->buckets[bucket] != 0)
+            bucket = (bucket + 1) & mask;
+        index->buckets[bucket] = i + 1;
+    }
+
+    if (err!=UNZ_OK)
+    {
+        unzlocal_FreeIndex(index);
+        return err;
+    }
+
+    s->index = index;
+    return UNZ_OK;
+}
+
 /*
   Try locate the file szFileName in the zipfile.
   For the iCaseSensitivity signification, see unzipStringFileNameCompare
@@ -848,6 +1265,15 @@ extern int ZEXPORT unzLocateFile (file, szFileName, iCaseSensitivity)
     if (!s->current_file_ok)
         return UNZ_END_OF_LIST_OF_FILE;
 
+    if (s->index!=NULL)
+    {
+        unz_file_pos file_pos;
+        err = unzlocal_SearchIndex(s->index,szFileName,iCaseSensitivity,&file_pos);
+        if (err == UNZ_OK)
+            err = unzGoToFilePos(file,&file_pos);
+        return err;
+    }
+
     /* Save the current state */
     num_fileSaved = s->num_file;
     pos_in_central_dirSaved = s->pos_in_central_dir;
@@ -881,6 +1307,50 @@ extern int ZEXPORT unzLocateFile (file, szFileName, iCaseSensitivity)
     return err;
 }
 
+/*
+  Same as unzLocateFile, but only report where the file is, leaving the
+  current file alone.
+*/
+extern int ZEXPORT unzLocateFilePos (file, szFileName, iCaseSensitivity, file_pos)
+    unzFile file;
+    const char *szFileName;
+    int iCaseSensitivity;
+    unz_file_pos* file_pos;
+{
+    unz_s* s;
+    int err;
+
+    unz_file_info cur_file_infoSaved;
+    unz_file_info_internal cur_file_info_internalSaved;
+    uLong num_fileSaved;
+    uLong pos_in_central_dirSaved;
+    uLong current_file_okSaved;
+
+    if (file==NULL || file_pos==NULL)
+        return UNZ_PARAMERROR;
+    s=(unz_s*)file;
+
+    if (s->index!=NULL)
+        return unzlocal_SearchIndex(s->index,szFileName,iCaseSensitivity,file_pos);
+
+    num_fileSaved = s->num_file;
+    pos_in_central_dirSaved = s->pos_in_central_dir;
+    cur_file_infoSaved = s->cur_file_info;
+    cur_file_info_internalSaved = s->cur_file_info_internal;
+    current_file_okSaved = s->current_file_ok;
+
+    err = unzLocateFile(file,szFileName,iCaseSensitivity);
+    if (err == UNZ_OK)
+        err = unzGetFilePos(file,file_pos);
+
+    s->num_file = num_fileSaved;
+    s->pos_in_central_dir = pos_in_central_dirSaved;
+    s->cur_file_info = cur_file_infoSaved;
+    s->cur_file_info_internal = cur_file_info_internalSaved;
+    s->current_file_ok = current_file_okSaved;
+    return err;
+}
+
 
 /*
 ///////////////////////////////////////////
@@ -1009,16 +1479,17 @@ local int unzlocal_CheckCurrentFileCoherencyHeader (s,piSizeVar,
                               ((uFlags & 8)==0))
         err=UNZ_BADZIPFILE;
 
+    /* Zip64 entries keep their real sizes in the local extra field */
     if (unzlocal_getLong(&s->z_filefunc, s->filestream,&uData) != UNZ_OK) /* size compr */
         err=UNZ_ERRNO;
     else if ((err==UNZ_OK) && (uData!=s->cur_file_info.compressed_size) &&
-                              ((uFlags & 8)==0))
+                              (uData!=MAXU32) && ((uFlags & 8)==0))
         err=UNZ_BADZIPFILE;
 
     if (unzlocal_getLong(&s->z_filefunc, s->filestream,&uData) != UNZ_OK) /* size uncompr */
         err=UNZ_ERRNO;
     else if ((err==UNZ_OK) && (uData!=s->cur_file_info.uncompressed_size) &&
-                              ((uFlags & 8)==0))
+                              (uData!=MAXU32) && ((uFlags & 8)==0))
         err=UNZ_BADZIPFILE;
 
 
@@ -1306,7 +1777,7 @@ extern int ZEXPORT unzReadCurrentFile  (file, buf, len)
 
         if ((pfile_in_zip_read_info->compression_method==0) || (pfile_in_zip_read_info->raw))
         {
-            uInt uDoCopy,i ;
+            uInt uDoCopy;
 
             if ((pfile_in_zip_read_info->stream.avail_in == 0) &&
                 (pfile_in_zip_read_info->rest_read_compressed == 0))
@@ -1318,13 +1789,14 @@ extern int ZEXPORT unzReadCurrentFile  (file, buf, len)
             else
                 uDoCopy = pfile_in_zip_read_info->stream.avail_in ;
 
-            for (i=0;i<uDoCopy;i++)
-                *(pfile_in_zip_read_info->stream.next_out+i) =
-                        *(pfile_in_zip_read_info->stream.next_in+i);
+            memcpy(pfile_in_zip_read_info->stream.next_out,
+                   pfile_in_zip_read_info->stream.next_in,uDoCopy);
 
-            pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32,
-                                pfile_in_zip_read_info->stream.next_out,
-                                uDoCopy);
+            /* Raw reads hand back compressed bytes, whose crc is never checked */
+            if (!pfile_in_zip_read_info->raw)
+                pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32,
+                                    pfile_in_zip_read_info->stream.next_out,
+                                    uDoCopy);
             pfile_in_zip_read_info->rest_read_uncompressed-=uDoCopy;
             pfile_in_zip_read_info->stream.avail_in -= uDoCopy;
             pfile_in_zip_read_info->stream.avail_out -= uDoCopy;
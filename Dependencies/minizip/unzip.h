@@ -221,6 +221,25 @@ extern int ZEXPORT unzGoToFilePos(
     unzFile file,
     unz_file_pos* file_pos);
 
+extern int ZEXPORT unzBuildIndex OF((unzFile file));
+/*
+  Read the central directory in a single pass and build an in-memory index
+    of the filenames, which is freed by unzClose.
+  Once it is built, unzLocateFile and unzLocateFilePos find a file with a
+    hash lookup instead of walking the central directory.
+  return UNZ_OK if there is no problem
+*/
+
+extern int ZEXPORT unzLocateFilePos OF((unzFile file,
+                     const char *szFileName,
+                     int iCaseSensitivity,
+                     unz_file_pos* file_pos));
+/*
+  Same as unzLocateFile, except the file doesn't become the current file;
+    its position is stored in *file_pos for unzGoToFilePos instead.
+  A position can be used with any unzFile opened on the same zipfile.
+*/
+
 /* ****************************************** */
 
 extern int ZEXPORT unzGetCurrentFileInfo OF((unzFile file,
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include "zlib.h"
 #include "zip.h"
 
@@ -83,31 +84,43 @@ const char zip_copyright[] =
    " zip 1.01 Copyright 1998-2004 Gilles Vollant - http://www.winimage.com/zLibDll";
 
 
-#define SIZEDATA_INDATABLOCK (4096-(4*4))
 
 #define LOCALHEADERMAGIC    (0x04034b50)
 #define CENTRALHEADERMAGIC  (0x02014b50)
 #define ENDHEADERMAGIC      (0x06054b50)
+#define ZIP64ENDHEADERMAGIC (0x06064b50)
+#define ZIP64ENDLOCATORMAGIC (0x07064b50)
 
 #define FLAG_LOCALHEADER_OFFSET (0x06)
 #define CRC_LOCALHEADER_OFFSET  (0x0e)
 
 #define SIZECENTRALHEADER (0x2e) /* 46 */
+#define SIZEENDHEADER     (0x16) /* 22 */
+#define SIZEZIP64ENDHEADER (0x38) /* 56 */
+#define SIZEZIP64ENDLOCATOR (0x14) /* 20 */
+#define SIZEZIP64LOCALEXTRA (0x14) /* 20: header, uncompressed and compressed size */
 
-typedef struct linkedlist_datablock_internal_s
-{
-  struct linkedlist_datablock_internal_s* next_datablock;
-  uLong  avail_in_this_block;
-  uLong  filled_in_this_block;
-  uLong  unused; /* for future use and alignement */
-  unsigned char data[SIZEDATA_INDATABLOCK];
-} linkedlist_datablock_internal;
-
-typedef struct linkedlist_data_s
+#define ZIP64EXTRAHEADERID  (0x0001)
+#define MAXU32              (0xffffffff)
+#define MAXU16              (0xffff)
+
+#define VERSIONNEEDED       (20)
+#define VERSIONNEEDED64     (45)
+
+#define INITIALCENTRALDIRSIZE (64*1024)
+
+#define MAXPARALLELTHREADS (64)
+#define SIZEDEFLATEDICTIONARY (32768)
+#define DEFAULTPARALLELBLOCKSIZE (1024*1024)
+
+/* The central directory is built in one contiguous buffer, so zipClose
+   can write it (along with the end of central directory record) at once. */
+typedef struct centraldir_data_s
 {
-    linkedlist_datablock_internal* first_block;
-    linkedlist_datablock_internal* last_block;
-} linkedlist_data;
+    unsigned char* data;
+    uLong size;
+    uLong capacity;
+} centraldir_data;
 
 
 typedef struct
@@ -124,6 +137,8 @@ typedef struct
 
     int  method;                /* compression method of file currenty wr.*/
     int  raw;                   /* 1 for directly writing raw data */
+    int  zip64;                 /* 1 if the local header has a Zip64 extra field */
+    uLong pos_zip64extrainfo;   /* offset of the sizes in that extra field */
     Byte buffered_data[Z_BUFSIZE];/* buffer contain compressed data to be writ*/
     uLong dosDate;
     uLong crc32;
@@ -133,13 +148,23 @@ typedef struct
     const unsigned long* pcrc_32_tab;
     int crypt_header_size;
 #endif
+
+    int  parallel;              /* 1 if deflating in independent blocks */
+    int  level;                 /* deflateInit2 parameters for the blocks */
+    int  windowBits;
+    int  memLevel;
+    int  strategy;
+    Byte* parallel_in;          /* input waiting to be deflated */
+    uLong parallel_in_size;
+    Byte* dictionary;           /* tail of the input already deflated */
+    uInt dictionary_size;
 } curfile_info;
 
 typedef struct
 {
     zlib_filefunc_def z_filefunc;
     voidpf filestream;        /* io structore of the zipfile */
-    linkedlist_data central_dir;/* datablock with central dir in construction*/
+    centraldir_data central_dir;/* central dir in construction */
     int  in_opened_file_inzip;  /* 1 if a file in the zip is currently writ.*/
     curfile_info ci;            /* info on the file curretly writing */
 
@@ -149,8 +174,27 @@ typedef struct
 #ifndef NO_ADDFILEINEXISTINGZIP
     char *globalcomment;
 #endif
+
+    int  parallel_threads;      /* set by zipSetParallelDeflate */
+    uLong parallel_block_size;
 } zip_internal;
 
+typedef struct
+{
+    const Byte* in;
+    uLong in_size;
+    const Byte* dictionary;
+    uInt dictionary_size;
+    int  last;                  /* 1 for the block that ends the stream */
+    const curfile_info* ci;     /* deflateInit2 parameters */
+
+    Byte* out;
+    uLong out_size;
+    uLong crc32;
+    int  data_type;
+    int  err;
+} parallel_block;
+
 
 
 #ifndef NOCRYPT
@@ -158,96 +202,60 @@ typedef struct
 #include "crypt.h"
 #endif
 
-local linkedlist_datablock_internal* allocate_new_datablock()
-{
-    linkedlist_datablock_internal* ldi;
-    ldi = (linkedlist_datablock_internal*)
-                 ALLOC(sizeof(linkedlist_datablock_internal));
-    if (ldi!=NULL)
-    {
-        ldi->next_datablock = NULL ;
-        ldi->filled_in_this_block = 0 ;
-        ldi->avail_in_this_block = SIZEDATA_INDATABLOCK ;
-    }
-    return ldi;
-}
-
-local void free_datablock(ldi)
-    linkedlist_datablock_internal* ldi;
-{
-    while (ldi!=NULL)
-    {
-        linkedlist_datablock_internal* ldinext = ldi->next_datablock;
-        TRYFREE(ldi);
-        ldi = ldinext;
-    }
-}
-
-local void init_linkedlist(ll)
-    linkedlist_data* ll;
+local void init_centraldir(cd)
+    centraldir_data* cd;
 {
-    ll->first_block = ll->last_block = NULL;
+    cd->data = NULL;
+    cd->size = cd->capacity = 0;
 }
 
-local void free_linkedlist(ll)
-    linkedlist_data* ll;
+local void free_centraldir(cd)
+    centraldir_data* cd;
 {
-    free_datablock(ll->first_block);
-    ll->first_block = ll->last_block = NULL;
+    TRYFREE(cd->data);
+    init_centraldir(cd);
 }
 
-
-local int add_data_in_datablock(ll,buf,len)
-    linkedlist_data* ll;
-    const void* buf;
+local int reserve_in_centraldir(cd,len)
+    centraldir_data* cd;
     uLong len;
 {
-    linkedlist_datablock_internal* ldi;
-    const unsigned char* from_copy;
+    uLong capacity;
+    unsigned char* data;
 
-    if (ll==NULL)
+    if (cd==NULL)
         return ZIP_INTERNALERROR;
+    if (cd->capacity - cd->size >= len)
+        return ZIP_OK;
 
-    if (ll->last_block == NULL)
+    capacity = (cd->capacity > 0) ? cd->capacity : INITIALCENTRALDIRSIZE;
+    while (capacity - cd->size < len)
     {
-        ll->first_block = ll->last_block = allocate_new_datablock();
-        if (ll->first_block == NULL)
+        if (capacity > ((uLong)-1)/2)
             return ZIP_INTERNALERROR;
+        capacity *= 2;
     }
 
-    ldi = ll->last_block;
-    from_copy = (unsigned char*)buf;
-
-    while (len>0)
-    {
-        uInt copy_this;
-        uInt i;
-        unsigned char* to_copy;
-
-        if (ldi->avail_in_this_block==0)
-        {
-            ldi->next_datablock = allocate_new_datablock();
-            if (ldi->next_datablock == NULL)
-                return ZIP_INTERNALERROR;
-            ldi = ldi->next_datablock ;
-            ll->last_block = ldi;
-        }
-
-        if (ldi->avail_in_this_block < len)
-            copy_this = (uInt)ldi->avail_in_this_block;
-        else
-            copy_this = (uInt)len;
+    data = (unsigned char*)realloc(cd->data, capacity);
+    if (data == NULL)
+        return ZIP_INTERNALERROR;
 
-        to_copy = &(ldi->data[ldi->filled_in_this_block]);
+    cd->data = data;
+    cd->capacity = capacity;
+    return ZIP_OK;
+}
 
-        for (i=0;i<copy_this;i++)
-            *(to_copy+i)=*(from_copy+i);
+local int add_data_in_centraldir(cd,buf,len)
+    centraldir_data* cd;
+    const void* buf;
+    uLong len;
+{
+    int err = reserve_in_centraldir(cd,len);
+    if (err != ZIP_OK)
+        return err;
 
-        ldi->filled_in_this_block += copy_this;
-        ldi->avail_in_this_block -= copy_this;
-        from_copy += copy_this ;
-        len -= copy_this;
-    }
+    memcpy(cd->data + cd->size, buf, len);
+    cd->size += len;
     return ZIP_OK;
 }
 
@@ -269,7 +277,7 @@ local int ziplocal_putValue (pzlib_filefunc_def, filestream, x, nbByte)
     uLong x;
     int nbByte;
 {
-    unsigned char buf[4];
+    unsigned char buf[8];
     int n;
     for (n = 0; n < nbByte; n++)
     {
@@ -526,7 +534,12 @@ extern zipFile ZEXPORT zipOpen2 (pathname, append, globalcomment, pzlib_filefunc
     ziinit.ci.stream_initialised = 0;
     ziinit.number_entry = 0;
     ziinit.add_position_when_writting_offset = 0;
-    init_linkedlist(&(ziinit.central_dir));
+    ziinit.parallel_threads = 0;
+    ziinit.parallel_block_size = 0;
+    ziinit.ci.parallel = 0;
+    ziinit.ci.parallel_in = NULL;
+    ziinit.ci.dictionary = NULL;
+    init_centraldir(&(ziinit.central_dir));
 
 
     zi = (zip_internal*)ALLOC(sizeof(zip_internal));
@@ -627,29 +640,21 @@ extern zipFile ZEXPORT zipOpen2 (pathname, append, globalcomment, pzlib_filefunc
                                 (offset_central_dir+size_central_dir);
         ziinit.add_position_when_writting_offset = byte_before_the_zipfile;
 
+        if (ZSEEK(ziinit.z_filefunc, ziinit.filestream,
+              offset_central_dir + byte_before_the_zipfile,
+              ZLIB_FILEFUNC_SEEK_SET) != 0)
+              err=ZIP_ERRNO;
+
+        if (err==ZIP_OK)
+            err = reserve_in_centraldir(&ziinit.central_dir,size_central_dir);
+
+        if ((err==ZIP_OK) && (size_central_dir>0))
         {
-            uLong size_central_dir_to_read = size_central_dir;
-            size_t buf_size = SIZEDATA_INDATABLOCK;
-            void* buf_read = (void*)ALLOC(buf_size);
-            if (ZSEEK(ziinit.z_filefunc, ziinit.filestream,
-                  offset_central_dir + byte_before_the_zipfile,
-                  ZLIB_FILEFUNC_SEEK_SET) != 0)
-                  err=ZIP_ERRNO;
-
-            while ((size_central_dir_to_read>0) && (err==ZIP_OK))
-            {
-                uLong read_this = SIZEDATA_INDATABLOCK;
-                if (read_this > size_central_dir_to_read)
-                    read_this = size_central_dir_to_read;
-                if (ZREAD(ziinit.z_filefunc, ziinit.filestream,buf_read,read_this) != read_this)
-                    err=ZIP_ERRNO;
-
-                if (err==ZIP_OK)
-                    err = add_data_in_datablock(&ziinit.central_dir,buf_read,
-                                                (uLong)read_this);
-                size_central_dir_to_read-=read_this;
-            }
-            TRYFREE(buf_read);
+            if (ZREAD(ziinit.z_filefunc, ziinit.filestream,
+                      ziinit.central_dir.data,size_central_dir) != size_central_dir)
+                err=ZIP_ERRNO;
+            else
+                ziinit.central_dir.size = size_central_dir;
         }
         ziinit.begin_pos = byte_before_the_zipfile;
         ziinit.number_entry = number_entry_CD;
@@ -670,6 +675,7 @@ extern zipFile ZEXPORT zipOpen2 (pathname, append, globalcomment, pzlib_filefunc
 #    ifndef NO_ADDFILEINEXISTINGZIP
         TRYFREE(ziinit.globalcomment);
 #    endif /* !NO_ADDFILEINEXISTINGZIP*/
+        free_centraldir(&ziinit.central_dir);
         TRYFREE(zi);
         return NULL;
     }
@@ -687,12 +693,12 @@ extern zipFile ZEXPORT zipOpen (pathname, append)
     return zipOpen2(pathname,append,NULL,NULL);
 }
 
-extern int ZEXPORT zipOpenNewFileInZip3 (file, filename, zipfi,
-                                         extrafield_local, size_extrafield_local,
-                                         extrafield_global, size_extrafield_global,
-                                         comment, method, level, raw,
-                                         windowBits, memLevel, strategy,
-                                         password, crcForCrypting)
+extern int ZEXPORT zipOpenNewFileInZip3_64 (file, filename, zipfi,
+                                            extrafield_local, size_extrafield_local,
+                                            extrafield_global, size_extrafield_global,
+                                            comment, method, level, raw,
+                                            windowBits, memLevel, strategy,
+                                            password, crcForCrypting, zip64)
     zipFile file;
     const char* filename;
     const zip_fileinfo* zipfi;
@@ -709,11 +715,11 @@ extern int ZEXPORT zipOpenNewFileInZip3 (file, filename, zipfi,
     int strategy;
     const char* password;
     uLong crcForCrypting;
+    int zip64;
 {
     zip_internal* zi;
     uInt size_filename;
     uInt size_comment;
-    uInt i;
     int err = ZIP_OK;
 
 #    ifdef NOCRYPT
@@ -771,6 +777,11 @@ extern int ZEXPORT zipOpenNewFileInZip3 (file, filename, zipfi,
     zi->ci.stream_initialised = 0;
     zi->ci.pos_in_buffered_data = 0;
     zi->ci.raw = raw;
+    zi->ci.zip64 = zip64;
+    zi->ci.pos_zip64extrainfo = 0;
+    zi->ci.parallel = 0;
+    zi->ci.parallel_in_size = 0;
+    zi->ci.dictionary_size = 0;
     zi->ci.pos_local_header = ZTELL(zi->z_filefunc,zi->filestream) ;
     zi->ci.size_centralheader = SIZECENTRALHEADER + size_filename +
                                       size_extrafield_global + size_comment;
@@ -779,7 +790,7 @@ extern int ZEXPORT zipOpenNewFileInZip3 (file, filename, zipfi,
     ziplocal_putValue_inmemory(zi->ci.central_header,(uLong)CENTRALHEADERMAGIC,4);
     /* version info */
     ziplocal_putValue_inmemory(zi->ci.central_header+4,(uLong)VERSIONMADEBY,2);
-    ziplocal_putValue_inmemory(zi->ci.central_header+6,(uLong)20,2);
+    ziplocal_putValue_inmemory(zi->ci.central_header+6,(uLong)(zip64 ? VERSIONNEEDED64 : VERSIONNEEDED),2);
     ziplocal_putValue_inmemory(zi->ci.central_header+8,(uLong)zi->ci.flag,2);
     ziplocal_putValue_inmemory(zi->ci.central_header+10,(uLong)zi->ci.method,2);
     ziplocal_putValue_inmemory(zi->ci.central_header+12,(uLong)zi->ci.dosDate,4);
@@ -803,24 +814,21 @@ extern int ZEXPORT zipOpenNewFileInZip3 (file, filename, zipfi,
 
     ziplocal_putValue_inmemory(zi->ci.central_header+42,(uLong)zi->ci.pos_local_header- zi->add_position_when_writting_offset,4);
 
-    for (i=0;i<size_filename;i++)
-        *(zi->ci.central_header+SIZECENTRALHEADER+i) = *(filename+i);
+    memcpy(zi->ci.central_header+SIZECENTRALHEADER,filename,size_filename);
 
-    for (i=0;i<size_extrafield_global;i++)
-        *(zi->ci.central_header+SIZECENTRALHEADER+size_filename+i) =
-              *(((const char*)extrafield_global)+i);
+    if (size_extrafield_global>0)
+        memcpy(zi->ci.central_header+SIZECENTRALHEADER+size_filename,
+               extrafield_global,size_extrafield_global);
 
-    for (i=0;i<size_comment;i++)
-        *(zi->ci.central_header+SIZECENTRALHEADER+size_filename+
-              size_extrafield_global+i) = *(comment+i);
-    if (zi->ci.central_header == NULL)
-        return ZIP_INTERNALERROR;
+    if (size_comment>0)
+        memcpy(zi->ci.central_header+SIZECENTRALHEADER+size_filename+
+               size_extrafield_global,comment,size_comment);
 
     /* write the local header */
     err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)LOCALHEADERMAGIC,4);
 
     if (err==ZIP_OK)
-        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)20,2);/* version needed to extract */
+        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)(zip64 ? VERSIONNEEDED64 : VERSIONNEEDED),2);/* version needed to extract */
     if (err==ZIP_OK)
         err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)zi->ci.flag,2);
 
@@ -832,16 +840,18 @@ extern int ZEXPORT zipOpenNewFileInZip3 (file, filename, zipfi,
 
     if (err==ZIP_OK)
         err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)0,4); /* crc 32, unknown */
+    /* Zip64 entries always defer their sizes to the extra field */
     if (err==ZIP_OK)
-        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)0,4); /* compressed size, unknown */
+        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)(zip64 ? MAXU32 : 0),4); /* compressed size, unknown */
     if (err==ZIP_OK)
-        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)0,4); /* uncompressed size, unknown */
+        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)(zip64 ? MAXU32 : 0),4); /* uncompressed size, unknown */
 
     if (err==ZIP_OK)
         err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)size_filename,2);
 
     if (err==ZIP_OK)
-        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)size_extrafield_local,2);
+        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,
+                                (uLong)size_extrafield_local + (zip64 ? SIZEZIP64LOCALEXTRA : 0),2);
 
     if ((err==ZIP_OK) && (size_filename>0))
         if (ZWRITE(zi->z_filefunc,zi->filestream,filename,size_filename)!=size_filename)
@@ -852,6 +862,20 @@ extern int ZEXPORT zipOpenNewFileInZip3 (file, filename, zipfi,
                                                                            !=size_extrafield_local)
                 err = ZIP_ERRNO;
 
+    if ((err==ZIP_OK) && (zip64))
+    {
+        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)ZIP64EXTRAHEADERID,2);
+        if (err==ZIP_OK)
+            err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)16,2);
+
+        zi->ci.pos_zip64extrainfo = ZTELL(zi->z_filefunc,zi->filestream);
+
+        if (err==ZIP_OK) /* uncompressed size, unknown */
+            err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)0,8);
+        if (err==ZIP_OK) /* compressed size, unknown */
+            err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)0,8);
+    }
+
     zi->ci.stream.avail_in = (uInt)0;
     zi->ci.stream.avail_out = (uInt)Z_BUFSIZE;
     zi->ci.stream.next_out = zi->ci.buffered_data;
@@ -872,6 +896,22 @@ extern int ZEXPORT zipOpenNewFileInZip3 (file, filename, zipfi,
 
         if (err==Z_OK)
             zi->ci.stream_initialised = 1;
+
+        if ((err==Z_OK) && (zi->parallel_threads > 1) && (password == NULL))
+        {
+            zi->ci.parallel = 1;
+            zi->ci.level = level;
+            zi->ci.windowBits = windowBits;
+            zi->ci.memLevel = memLevel;
+            zi->ci.strategy = strategy;
+
+            if (zi->ci.parallel_in == NULL)
+                zi->ci.parallel_in = (Byte*)ALLOC(zi->parallel_threads * zi->parallel_block_size);
+            if (zi->ci.dictionary == NULL)
+                zi->ci.dictionary = (Byte*)ALLOC(SIZEDEFLATEDICTIONARY);
+            if ((zi->ci.parallel_in == NULL) || (zi->ci.dictionary == NULL))
+                err = ZIP_INTERNALERROR;
+        }
     }
 #    ifndef NOCRYPT
     zi->ci.crypt_header_size = 0;
@@ -896,6 +936,84 @@ extern int ZEXPORT zipOpenNewFileInZip3 (file, filename, zipfi,
     return err;
 }
 
+extern int ZEXPORT zipOpenNewFileInZip3 (file, filename, zipfi,
+                                         extrafield_local, size_extrafield_local,
+                                         extrafield_global, size_extrafield_global,
+                                         comment, method, level, raw,
+                                         windowBits, memLevel, strategy,
+                                         password, crcForCrypting)
+    zipFile file;
+    const char* filename;
+    const zip_fileinfo* zipfi;
+    const void* extrafield_local;
+    uInt size_extrafield_local;
+    const void* extrafield_global;
+    uInt size_extrafield_global;
+    const char* comment;
+    int method;
+    int level;
+    int raw;
+    int windowBits;
+    int memLevel;
+    int strategy;
+    const char* password;
+    uLong crcForCrypting;
+{
+    return zipOpenNewFileInZip3_64 (file, filename, zipfi,
+                                    extrafield_local, size_extrafield_local,
+                                    extrafield_global, size_extrafield_global,
+                                    comment, method, level, raw,
+                                    windowBits, memLevel, strategy,
+                                    password, crcForCrypting, 0);
+}
+
+extern int ZEXPORT zipOpenNewFileInZip2_64(file, filename, zipfi,
+                                           extrafield_local, size_extrafield_local,
+                                           extrafield_global, size_extrafield_global,
+                                           comment, method, level, raw, zip64)
+    zipFile file;
+    const char* filename;
+    const zip_fileinfo* zipfi;
+    const void* extrafield_local;
+    uInt size_extrafield_local;
+    const void* extrafield_global;
+    uInt size_extrafield_global;
+    const char* comment;
+    int method;
+    int level;
+    int raw;
+    int zip64;
+{
+    return zipOpenNewFileInZip3_64 (file, filename, zipfi,
+                                    extrafield_local, size_extrafield_local,
+                                    extrafield_global, size_extrafield_global,
+                                    comment, method, level, raw,
+                                    -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY,
+                                    NULL, 0, zip64);
+}
+
+extern int ZEXPORT zipOpenNewFileInZip64 (file, filename, zipfi,
+                                          extrafield_local, size_extrafield_local,
+                                          extrafield_global, size_extrafield_global,
+                                          comment, method, level, zip64)
+    zipFile file;
+    const char* filename;
+    const zip_fileinfo* zipfi;
+    const void* extrafield_local;
+    uInt size_extrafield_local;
+    const void* extrafield_global;
+    uInt size_extrafield_global;
+    const char* comment;
+    int method;
+    int level;
+    int zip64;
+{
+    return zipOpenNewFileInZip2_64 (file, filename, zipfi,
+                                    extrafield_local, size_extrafield_local,
+                                    extrafield_global, size_extrafield_global,
+                                    comment, method, level, 0, zip64);
+}
+
 extern int ZEXPORT zipOpenNewFileInZip2(file, filename, zipfi,
                                         extrafield_local, size_extrafield_local,
                                         extrafield_global, size_extrafield_global,
@@ -963,6 +1081,203 @@ local int zipFlushWriteBuffer(zi)
     return err;
 }
 
+local void* ziplocal_DeflateBlock OF((void* arg));
+local void* ziplocal_DeflateBlock (arg)
+    void* arg;
+{
+    parallel_block* block = (parallel_block*)arg;
+    z_stream stream;
+    int flush = block->last ? Z_FINISH : Z_SYNC_FLUSH;
+    uLong out_capacity;
+    int err;
+
+    block->out = NULL;
+    block->out_size = 0;
+    block->crc32 = crc32(0L,block->in,(uInt)block->in_size);
+
+    stream.zalloc = (alloc_func)0;
+    stream.zfree = (free_func)0;
+    stream.opaque = (voidpf)0;
+
+    err = deflateInit2(&stream, block->ci->level, Z_DEFLATED,
+                       block->ci->windowBits, block->ci->memLevel, block->ci->strategy);
+    if ((err==Z_OK) && (block->dictionary_size>0))
+        err = deflateSetDictionary(&stream, block->dictionary, block->dictionary_size);
+    if (err!=Z_OK)
+    {
+        block->err = ZIP_INTERNALERROR;
+        return NULL;
+    }
+
+    /* leave room for the sync flush marker on top of the deflate bound */
+    out_capacity = deflateBound(&stream, block->in_size) + 16;
+    block->out = (Byte*)ALLOC(out_capacity);
+
+    stream.next_in = (Bytef*)block->in;
+    stream.avail_in = (uInt)block->in_size;
+
+    while (block->out != NULL)
+    {
+        stream.next_out = block->out + block->out_size;
+        stream.avail_out = (uInt)(out_capacity - block->out_size);
+
+        err = deflate(&stream, flush);
+        block->out_size = out_capacity - stream.avail_out;
+
+        if (err == Z_STREAM_END)
+            break;
+        if ((err != Z_OK) && (err != Z_BUF_ERROR))
+            break;
+        if ((flush == Z_SYNC_FLUSH) && (stream.avail_in == 0) && (stream.avail_out > 0))
+            break;
+
+        if (stream.avail_out == 0)
+        {
+            Byte* out;
+            out_capacity *= 2;
+            out = (Byte*)realloc(block->out, out_capacity);
+            if (out == NULL)
+                TRYFREE(block->out);
+            block->out = out;
+        }
+    }
+
+    if (block->out == NULL)
+        block->err = ZIP_INTERNALERROR;
+    else if (block->last)
+        block->err = (err == Z_STREAM_END) ? ZIP_OK : ZIP_INTERNALERROR;
+    else
+        block->err = ((err == Z_OK) || (err == Z_BUF_ERROR)) ? ZIP_OK : ZIP_INTERNALERROR;
+
+    block->data_type = stream.data_type;
+    deflateEnd(&stream);
+    return NULL;
+}
+
+/*
+  Deflate the pending input as up to parallel_threads independent blocks.
+  Every block but the last of the entry ends on a sync flush, so the
+  concatenated output is a single ordinary deflate stream. Each block is
+  primed with the 32K of input preceding it, which keeps the compression
+  ratio close to that of a single stream.
+*/
+local int ziplocal_FlushParallelBlocks OF((zip_internal* zi, int last));
+local int ziplocal_FlushParallelBlocks (zi, last)
+    zip_internal* zi;
+    int last;
+{
+    parallel_block blocks[MAXPARALLELTHREADS];
+    pthread_t threads[MAXPARALLELTHREADS];
+    int started[MAXPARALLELTHREADS];
+    uLong block_size = zi->parallel_block_size;
+    uLong offset = 0;
+    int nb_blocks = 0;
+    int err = ZIP_OK;
+    int i;
+
+    do
+    {
+        parallel_block* block = &blocks[nb_blocks];
+        block->in = zi->ci.parallel_in + offset;
+        block->in_size = zi->ci.parallel_in_size - offset;
+        if (block->in_size > block_size)
+            block->in_size = block_size;
+        if (offset == 0)
+        {
+            block->dictionary = zi->ci.dictionary;
+            block->dictionary_size = zi->ci.dictionary_size;
+        }
+        else
+        {
+            block->dictionary_size = (offset < SIZEDEFLATEDICTIONARY) ? (uInt)offset : SIZEDEFLATEDICTIONARY;
+            block->dictionary = block->in - block->dictionary_size;
+        }
+        block->ci = &zi->ci;
+        block->err = ZIP_OK;
+        offset += block->in_size;
+        nb_blocks++;
+        block->last = last && (offset == zi->ci.parallel_in_size);
+    } while (offset < zi->ci.parallel_in_size);
+
+    /* the calling thread deflates the first block itself */
+    for (i=1;i<nb_blocks;i++)
+        started[i] = (pthread_create(&threads[i], NULL, ziplocal_DeflateBlock, &blocks[i]) == 0);
+    ziplocal_DeflateBlock(&blocks[0]);
+    for (i=1;i<nb_blocks;i++)
+    {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            ziplocal_DeflateBlock(&blocks[i]);
+    }
+
+    for (i=0;i<nb_blocks;i++)
+    {
+        parallel_block* block = &blocks[i];
+
+        if (err==ZIP_OK)
+            err = block->err;
+
+        if (err==ZIP_OK)
+        {
+            if (zi->ci.stream.total_in == 0)
+                zi->ci.stream.data_type = block->data_type;
+
+            zi->ci.crc32 = crc32_combine(zi->ci.crc32, block->crc32, (z_off_t)block->in_size);
+            zi->ci.stream.total_in += block->in_size;
+            zi->ci.stream.total_out += block->out_size;
+
+            if (ZWRITE(zi->z_filefunc,zi->filestream,block->out,block->out_size) != block->out_size)
+                err = ZIP_ERRNO;
+        }
+
+        TRYFREE(block->out);
+    }
+
+    if ((err==ZIP_OK) && (!last))
+    {
+        uLong tail = (zi->ci.parallel_in_size < SIZEDEFLATEDICTIONARY) ?
+                        zi->ci.parallel_in_size : SIZEDEFLATEDICTIONARY;
+        memcpy(zi->ci.dictionary, zi->ci.parallel_in + zi->ci.parallel_in_size - tail, tail);
+        zi->ci.dictionary_size = (uInt)tail;
+    }
+    zi->ci.parallel_in_size = 0;
+
+    return err;
+}
+
+extern int ZEXPORT zipSetParallelDeflate (file, threads, block_size)
+    zipFile file;
+    int threads;
+    uLong block_size;
+{
+    zip_internal* zi;
+
+    if (file == NULL)
+        return ZIP_PARAMERROR;
+    zi = (zip_internal*)file;
+
+    if (zi->in_opened_file_inzip == 1)
+        return ZIP_PARAMERROR;
+
+    if (threads > MAXPARALLELTHREADS)
+        threads = MAXPARALLELTHREADS;
+    if (block_size == 0)
+        block_size = DEFAULTPARALLELBLOCKSIZE;
+    if (block_size < SIZEDEFLATEDICTIONARY)
+        block_size = SIZEDEFLATEDICTIONARY;
+
+    if ((threads != zi->parallel_threads) || (block_size != zi->parallel_block_size))
+    {
+        TRYFREE(zi->ci.parallel_in);
+        zi->ci.parallel_in = NULL;
+    }
+
+    zi->parallel_threads = threads;
+    zi->parallel_block_size = block_size;
+    return ZIP_OK;
+}
+
 extern int ZEXPORT zipWriteInFileInZip (file, buf, len)
     zipFile file;
     const void* buf;
@@ -980,7 +1295,31 @@ extern int ZEXPORT zipWriteInFileInZip (file, buf, len)
 
     zi->ci.stream.next_in = (void*)buf;
     zi->ci.stream.avail_in = len;
-    zi->ci.crc32 = crc32(zi->ci.crc32,buf,len);
+    if (zi->ci.parallel)
+    {
+        const Byte* in = (const Byte*)buf;
+        uLong capacity = zi->parallel_threads * zi->parallel_block_size;
+
+        while ((err==ZIP_OK) && (len>0))
+        {
+            uLong copy_this = capacity - zi->ci.parallel_in_size;
+            if (copy_this > len)
+                copy_this = len;
+            memcpy(zi->ci.parallel_in + zi->ci.parallel_in_size, in, copy_this);
+            zi->ci.parallel_in_size += copy_this;
+            in += copy_this;
+            len -= (unsigned)copy_this;
+
+            /* hold back a full batch until more input arrives, so the last one can finish the stream */
+            if ((zi->ci.parallel_in_size == capacity) && (len>0))
+                err = ziplocal_FlushParallelBlocks(zi, 0);
+        }
+        return err;
+    }
+
+    /* In raw mode the caller supplies the crc to zipCloseFileInZipRaw */
+    if (!zi->ci.raw)
+        zi->ci.crc32 = crc32(zi->ci.crc32,buf,len);
 
     while ((err==ZIP_OK) && (zi->ci.stream.avail_in>0))
     {
@@ -1005,14 +1344,12 @@ extern int ZEXPORT zipWriteInFileInZip (file, buf, len)
         }
         else
         {
-            uInt copy_this,i;
+            uInt copy_this;
             if (zi->ci.stream.avail_in < zi->ci.stream.avail_out)
                 copy_this = zi->ci.stream.avail_in;
             else
                 copy_this = zi->ci.stream.avail_out;
-            for (i=0;i<copy_this;i++)
-                *(((char*)zi->ci.stream.next_out)+i) =
-                    *(((const char*)zi->ci.stream.next_in)+i);
+            memcpy(zi->ci.stream.next_out,zi->ci.stream.next_in,copy_this);
             {
                 zi->ci.stream.avail_in -= copy_this;
                 zi->ci.stream.avail_out-= copy_this;
@@ -1028,6 +1365,79 @@ extern int ZEXPORT zipWriteInFileInZip (file, buf, len)
     return err;
 }
 
+/*
+  Append a Zip64 extra field to the current central header for whichever of
+  the sizes and local header offset don't fit in their 32-bit fields (those
+  fields already read 0xffffffff, see ziplocal_putValue_inmemory).
+*/
+local int ziplocal_AddZip64ExtraToCentralHeader OF((zip_internal* zi,
+                                                    uLong uncompressed_size,
+                                                    uLong compressed_size,
+                                                    uLong offset_local_header));
+local int ziplocal_AddZip64ExtraToCentralHeader (zi, uncompressed_size, compressed_size,
+                                                 offset_local_header)
+    zip_internal* zi;
+    uLong uncompressed_size;
+    uLong compressed_size;
+    uLong offset_local_header;
+{
+    unsigned char* header = (unsigned char*)zi->ci.central_header;
+    uLong size_filename = header[28] | (header[29]<<8);
+    uLong size_extrafield = header[30] | (header[31]<<8);
+    uLong size_comment = header[32] | (header[33]<<8);
+    uLong pos_extra = SIZECENTRALHEADER + size_filename + size_extrafield;
+    uLong size_zip64extra = 0;
+    unsigned char* extra;
+
+    if (uncompressed_size>=MAXU32)
+        size_zip64extra += 8;
+    if (compressed_size>=MAXU32)
+        size_zip64extra += 8;
+    if (offset_local_header>=MAXU32)
+        size_zip64extra += 8;
+
+    if (size_zip64extra==0)
+        return ZIP_OK;
+
+    if (size_extrafield + 4 + size_zip64extra > MAXU16)
+        return ZIP_PARAMERROR;
+
+    header = (unsigned char*)realloc(zi->ci.central_header,
+                                     zi->ci.size_centralheader + 4 + size_zip64extra);
+    if (header==NULL)
+        return ZIP_INTERNALERROR;
+    zi->ci.central_header = (char*)header;
+
+    /* the extra field goes between the existing extra fields and the comment */
+    memmove(header + pos_extra + 4 + size_zip64extra, header + pos_extra, size_comment);
+
+    extra = header + pos_extra;
+    ziplocal_putValue_inmemory(extra,(uLong)ZIP64EXTRAHEADERID,2);
+    ziplocal_putValue_inmemory(extra+2,size_zip64extra,2);
+    extra += 4;
+
+    if (uncompressed_size>=MAXU32)
+    {
+        ziplocal_putValue_inmemory(extra,uncompressed_size,8);
+        extra += 8;
+    }
+    if (compressed_size>=MAXU32)
+    {
+        ziplocal_putValue_inmemory(extra,compressed_size,8);
+        extra += 8;
+    }
+    if (offset_local_header>=MAXU32)
+    {
+        ziplocal_putValue_inmemory(extra,offset_local_header,8);
+        extra += 8;
+    }
+
+    ziplocal_putValue_inmemory(header+6,(uLong)VERSIONNEEDED64,2);
+    ziplocal_putValue_inmemory(header+30,size_extrafield + 4 + size_zip64extra,2);
+    zi->ci.size_centralheader += 4 + size_zip64extra;
+    return ZIP_OK;
+}
+
 extern int ZEXPORT zipCloseFileInZipRaw (file, uncompressed_size, crc32)
     zipFile file;
     uLong uncompressed_size;
@@ -1045,7 +1455,14 @@ extern int ZEXPORT zipCloseFileInZipRaw (file, uncompressed_size, crc32)
         return ZIP_PARAMERROR;
     zi->ci.stream.avail_in = 0;
 
-    if ((zi->ci.method == Z_DEFLATED) && (!zi->ci.raw))
+    if (zi->ci.parallel)
+    {
+        if ((zi->ci.pos_in_buffered_data>0) && (zipFlushWriteBuffer(zi)==ZIP_ERRNO))
+            err = ZIP_ERRNO;
+        if (err==ZIP_OK)
+            err = ziplocal_FlushParallelBlocks(zi, 1);
+    }
+    else if ((zi->ci.method == Z_DEFLATED) && (!zi->ci.raw))
         while (err==ZIP_OK)
     {
         uLong uTotalOutBefore;
@@ -1070,7 +1487,9 @@ extern int ZEXPORT zipCloseFileInZipRaw (file, uncompressed_size, crc32)
 
     if ((zi->ci.method == Z_DEFLATED) && (!zi->ci.raw))
     {
-        err=deflateEnd(&zi->ci.stream);
+        int end_err=deflateEnd(&zi->ci.stream);
+        if (err==ZIP_OK)
+            err = end_err;
         zi->ci.stream_initialised = 0;
     }
 
@@ -1087,13 +1506,22 @@ extern int ZEXPORT zipCloseFileInZipRaw (file, uncompressed_size, crc32)
     ziplocal_putValue_inmemory(zi->ci.central_header+16,crc32,4); /*crc*/
     ziplocal_putValue_inmemory(zi->ci.central_header+20,
                                 compressed_size,4); /*compr size*/
-    if (zi->ci.stream.data_type == Z_ASCII)
+    if ((zi->ci.stream.data_type == Z_ASCII) && (!zi->ci.raw))
         ziplocal_putValue_inmemory(zi->ci.central_header+36,(uLong)Z_ASCII,2);
     ziplocal_putValue_inmemory(zi->ci.central_header+24,
                                 uncompressed_size,4); /*uncompr size*/
 
+    /* without a Zip64 extra field the local header can't hold sizes this large */
+    if ((err==ZIP_OK) && (!zi->ci.zip64) &&
+        ((compressed_size>=MAXU32) || (uncompressed_size>=MAXU32)))
+        err = ZIP_PARAMERROR;
+
     if (err==ZIP_OK)
-        err = add_data_in_datablock(&zi->central_dir,zi->ci.central_header,
+        err = ziplocal_AddZip64ExtraToCentralHeader(zi,uncompressed_size,compressed_size,
+                    zi->ci.pos_local_header - zi->add_position_when_writting_offset);
+
+    if (err==ZIP_OK)
+        err = add_data_in_centraldir(&zi->central_dir,zi->ci.central_header,
                                        (uLong)zi->ci.size_centralheader);
     free(zi->ci.central_header);
 
@@ -1107,11 +1535,28 @@ extern int ZEXPORT zipCloseFileInZipRaw (file, uncompressed_size, crc32)
         if (err==ZIP_OK)
             err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,crc32,4); /* crc 32, unknown */
 
-        if (err==ZIP_OK) /* compressed size, unknown */
-            err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,compressed_size,4);
+        if (zi->ci.zip64)
+        {
+            /* the local header sizes stay 0xffffffff, the real ones go in the extra field */
+            if ((err==ZIP_OK) &&
+                (ZSEEK(zi->z_filefunc,zi->filestream,
+                       zi->ci.pos_zip64extrainfo,ZLIB_FILEFUNC_SEEK_SET)!=0))
+                err = ZIP_ERRNO;
 
-        if (err==ZIP_OK) /* uncompressed size, unknown */
-            err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,uncompressed_size,4);
+            if (err==ZIP_OK)
+                err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,uncompressed_size,8);
+
+            if (err==ZIP_OK)
+                err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,compressed_size,8);
+        }
+        else
+        {
+            if (err==ZIP_OK) /* compressed size, unknown */
+                err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,compressed_size,4);
+
+            if (err==ZIP_OK) /* uncompressed size, unknown */
+                err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,uncompressed_size,4);
+        }
 
         if (ZSEEK(zi->z_filefunc,zi->filestream,
                   cur_pos_inzip,ZLIB_FILEFUNC_SEEK_SET)!=0)
@@ -1138,7 +1583,9 @@ extern int ZEXPORT zipClose (file, global_comment)
     int err = 0;
     uLong size_centraldir = 0;
     uLong centraldir_pos_inzip;
+    uLong offset_centraldir;
     uInt size_global_comment;
+    int zip64;
     if (file == NULL)
         return ZIP_PARAMERROR;
     zi = (zip_internal*)file;
@@ -1158,53 +1605,81 @@ extern int ZEXPORT zipClose (file, global_comment)
         size_global_comment = (uInt)strlen(global_comment);
 
     centraldir_pos_inzip = ZTELL(zi->z_filefunc,zi->filestream);
-    if (err==ZIP_OK)
-    {
-        linkedlist_datablock_internal* ldi = zi->central_dir.first_block ;
-        while (ldi!=NULL)
-        {
-            if ((err==ZIP_OK) && (ldi->filled_in_this_block>0))
-                if (ZWRITE(zi->z_filefunc,zi->filestream,
-                           ldi->data,ldi->filled_in_this_block)
-                              !=ldi->filled_in_this_block )
-                    err = ZIP_ERRNO;
-
-            size_centraldir += ldi->filled_in_this_block;
-            ldi = ldi->next_datablock;
-        }
-    }
-    free_datablock(zi->central_dir.first_block);
+    size_centraldir = zi->central_dir.size;
 
-    if (err==ZIP_OK) /* Magic End */
-        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)ENDHEADERMAGIC,4);
+    offset_centraldir = centraldir_pos_inzip - zi->add_position_when_writting_offset;
 
-    if (err==ZIP_OK) /* number of this disk */
-        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)0,2);
+    /* the regular record's fields read 0xffff/0xffffffff when they overflow,
+       telling readers to look for the Zip64 records written before it */
+    zip64 = (zi->number_entry >= MAXU16) ||
+            (size_centraldir >= MAXU32) ||
+            (offset_centraldir >= MAXU32);
 
-    if (err==ZIP_OK) /* number of the disk with the start of the central directory */
-        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)0,2);
+    /* append the end of central directory records, then write everything at once */
+    if (err==ZIP_OK)
+        err = reserve_in_centraldir(&zi->central_dir,
+                                    (zip64 ? SIZEZIP64ENDHEADER + SIZEZIP64ENDLOCATOR : 0) +
+                                    SIZEENDHEADER + size_global_comment);
 
-    if (err==ZIP_OK) /* total number of entries in the central dir on this disk */
-        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)zi->number_entry,2);
+    if ((err==ZIP_OK) && (zip64))
+    {
+        unsigned char* end_header = zi->central_dir.data + zi->central_dir.size;
+        unsigned char* locator = end_header + SIZEZIP64ENDHEADER;
+
+        ziplocal_putValue_inmemory(end_header,(uLong)ZIP64ENDHEADERMAGIC,4);
+        /* size of the rest of the zip64 end of central directory record */
+        ziplocal_putValue_inmemory(end_header+4,(uLong)(SIZEZIP64ENDHEADER-12),8);
+        ziplocal_putValue_inmemory(end_header+12,(uLong)VERSIONMADEBY,2);
+        ziplocal_putValue_inmemory(end_header+14,(uLong)VERSIONNEEDED64,2);
+        /* number of this disk, and of the disk with the start of the central directory */
+        ziplocal_putValue_inmemory(end_header+16,(uLong)0,4);
+        ziplocal_putValue_inmemory(end_header+20,(uLong)0,4);
+        /* total number of entries in the central dir on this disk, and overall */
+        ziplocal_putValue_inmemory(end_header+24,(uLong)zi->number_entry,8);
+        ziplocal_putValue_inmemory(end_header+32,(uLong)zi->number_entry,8);
+        ziplocal_putValue_inmemory(end_header+40,(uLong)size_centraldir,8);
+        ziplocal_putValue_inmemory(end_header+48,(uLong)offset_centraldir,8);
+
+        ziplocal_putValue_inmemory(locator,(uLong)ZIP64ENDLOCATORMAGIC,4);
+        /* number of the disk with the zip64 end of central directory */
+        ziplocal_putValue_inmemory(locator+4,(uLong)0,4);
+        ziplocal_putValue_inmemory(locator+8,(uLong)(offset_centraldir + size_centraldir),8);
+        /* total number of disks */
+        ziplocal_putValue_inmemory(locator+16,(uLong)1,4);
+
+        zi->central_dir.size += SIZEZIP64ENDHEADER + SIZEZIP64ENDLOCATOR;
+    }
 
-    if (err==ZIP_OK) /* total number of entries in the central dir */
-        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)zi->number_entry,2);
+    if (err==ZIP_OK)
+    {
+        unsigned char* end_header = zi->central_dir.data + zi->central_dir.size;
 
-    if (err==ZIP_OK) /* size of the central directory */
-        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)size_centraldir,4);
+        ziplocal_putValue_inmemory(end_header,(uLong)ENDHEADERMAGIC,4);
+        /* number of this disk */
+        ziplocal_putValue_inmemory(end_header+4,(uLong)0,2);
+        /* number of the disk with the start of the central directory */
+        ziplocal_putValue_inmemory(end_header+6,(uLong)0,2);
+        /* total number of entries in the central dir on this disk */
+        ziplocal_putValue_inmemory(end_header+8,(uLong)zi->number_entry,2);
+        /* total number of entries in the central dir */
+        ziplocal_putValue_inmemory(end_header+10,(uLong)zi->number_entry,2);
+        /* size of the central directory */
+        ziplocal_putValue_inmemory(end_header+12,(uLong)size_centraldir,4);
+        /* offset of start of central directory with respect to the starting disk number */
+        ziplocal_putValue_inmemory(end_header+16,(uLong)offset_centraldir,4);
+        /* zipfile comment length */
+        ziplocal_putValue_inmemory(end_header+20,(uLong)size_global_comment,2);
 
-    if (err==ZIP_OK) /* offset of start of central directory with respect to the
-                            starting disk number */
-        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,
-                                (uLong)(centraldir_pos_inzip - zi->add_position_when_writting_offset),4);
+        if (size_global_comment>0)
+            memcpy(end_header+SIZEENDHEADER,global_comment,size_global_comment);
 
-    if (err==ZIP_OK) /* zipfile comment length */
-        err = ziplocal_putValue(&zi->z_filefunc,zi->filestream,(uLong)size_global_comment,2);
+        zi->central_dir.size += SIZEENDHEADER + size_global_comment;
 
-    if ((err==ZIP_OK) && (size_global_comment>0))
         if (ZWRITE(zi->z_filefunc,zi->filestream,
-                   global_comment,size_global_comment) != size_global_comment)
-                err = ZIP_ERRNO;
+                   zi->central_dir.data,zi->central_dir.size) != zi->central_dir.size)
+            err = ZIP_ERRNO;
+    }
+    free_centraldir(&zi->central_dir);
 
     if (ZCLOSE(zi->z_filefunc,zi->filestream) != 0)
         if (err == ZIP_OK)
@@ -1213,6 +1688,8 @@ extern int ZEXPORT zipClose (file, global_comment)
 #ifndef NO_ADDFILEINEXISTINGZIP
     TRYFREE(zi->globalcomment);
 #endif
+    TRYFREE(zi->ci.parallel_in);
+    TRYFREE(zi->ci.dictionary);
     TRYFREE(zi);
 
     return err;
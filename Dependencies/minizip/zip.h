@@ -201,6 +201,60 @@ extern int ZEXPORT zipOpenNewFileInZip3 OF((zipFile file,
  */
 
 
+extern int ZEXPORT zipOpenNewFileInZip64 OF((zipFile file,
+                                             const char* filename,
+                                             const zip_fileinfo* zipfi,
+                                             const void* extrafield_local,
+                                             uInt size_extrafield_local,
+                                             const void* extrafield_global,
+                                             uInt size_extrafield_global,
+                                             const char* comment,
+                                             int method,
+                                             int level,
+                                             int zip64));
+
+extern int ZEXPORT zipOpenNewFileInZip2_64 OF((zipFile file,
+                                               const char* filename,
+                                               const zip_fileinfo* zipfi,
+                                               const void* extrafield_local,
+                                               uInt size_extrafield_local,
+                                               const void* extrafield_global,
+                                               uInt size_extrafield_global,
+                                               const char* comment,
+                                               int method,
+                                               int level,
+                                               int raw,
+                                               int zip64));
+
+extern int ZEXPORT zipOpenNewFileInZip3_64 OF((zipFile file,
+                                               const char* filename,
+                                               const zip_fileinfo* zipfi,
+                                               const void* extrafield_local,
+                                               uInt size_extrafield_local,
+                                               const void* extrafield_global,
+                                               uInt size_extrafield_global,
+                                               const char* comment,
+                                               int method,
+                                               int level,
+                                               int raw,
+                                               int windowBits,
+                                               int memLevel,
+                                               int strategy,
+                                               const char* password,
+                                               uLong crcForCtypting,
+                                               int zip64));
+
+/*
+  Same as the functions above, except if zip64=1 the local header gets a
+    Zip64 extra field, which is required for files whose compressed or
+    uncompressed size is 0xffffffff bytes or more. Without it, closing such
+    a file fails with ZIP_PARAMERROR.
+  Offsets past 4 GB and archives with 65535 entries or more are handled
+    automatically when the central directory is written.
+  Zip64 relies on uLong being 64-bit.
+ */
+
+
 extern int ZEXPORT zipWriteInFileInZip OF((zipFile file,
                        const void* buf,
                        unsigned len));
@@ -208,6 +262,19 @@ extern int ZEXPORT zipWriteInFileInZip OF((zipFile file,
   Write data in the zipfile
 */
 
+extern int ZEXPORT zipSetParallelDeflate OF((zipFile file,
+                                             int threads,
+                                             uLong block_size));
+/*
+  Deflate files opened afterwards (method Z_DEFLATED, not raw, no password)
+    in blocks of block_size bytes, up to threads blocks at a time.
+  Each block is primed with the 32K of data preceding it and ends on a
+    sync flush, so the result is still a single ordinary deflate stream.
+  Files no larger than block_size are compressed exactly as they would be
+    without this call. threads <= 1 turns block deflating off again.
+  block_size 0 selects a 1 MB default.
+*/
+
 extern int ZEXPORT zipCloseFileInZip OF((zipFile file));
 /*
   Close the current file in the zipfile